@@ -0,0 +1,187 @@
+// Lexer benchmark: makes synthetic sources of a few shapes and sizes and times Tokenizer::tokenize() over them.
+// Everything is generated from fixed seeds, so numbers from two builds are measuring the same input.
+//
+// ./hydro_lexbench              runs 1, 10 and 100 MB of every shape
+// ./hydro_lexbench 1 5          runs 1 and 5 MB instead
+//
+// Numbers only mean something from an optimized build (-DCMAKE_BUILD_TYPE=Release).
+
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "../src/tokenization.hpp"
+#include "../tests/random.hpp"
+
+// Every heap allocation in the process bumps this, so we can tell how many the tokenizer makes per token
+static size_t g_allocations = 0;
+
+void* operator new(size_t size) {
+    g_allocations++;
+    if (void* p = malloc(size)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+std::string identifier(Random& rng) {
+    static constexpr char letters[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
+    std::string name(1, letters[rng.below(52)]);
+    size_t len = 2 + rng.below(12);
+    for (size_t i = 0; i < len; i++) {
+        name += rng.below(4) == 0 ? char('0' + rng.below(10)) : letters[rng.below(52)];
+    }
+    return name;
+}
+
+std::string literal(Random& rng) {
+    switch (rng.below(3)) {
+        case 0:
+            return std::to_string(rng.below(1000000000));
+        case 1:
+            return std::to_string(rng.below(10000)) + "." + std::to_string(rng.below(100000));
+        default:
+            return "." + std::to_string(rng.below(1000));
+    }
+}
+
+const char* op(Random& rng) {
+    static constexpr const char* ops[] = {" + ", " - ", " * ", " / "};
+    return ops[rng.below(4)];
+}
+
+// Lots of distinct names, which is mostly interner and keyword lookup work
+void identifier_heavy(Random& rng, std::string& out) {
+    out += "let " + identifier(rng) + " = " + identifier(rng);
+    for (size_t i = rng.below(6); i > 0; i--) {
+        out += op(rng) + identifier(rng);
+    }
+    out += ";\n";
+    if (rng.below(4) == 0) {
+        out += identifier(rng) + " = " + identifier(rng) + ";\n";
+    }
+}
+
+// Int and float literals, which is digit scanning and from_chars
+void literal_heavy(Random& rng, std::string& out) {
+    out += "let x = " + literal(rng);
+    for (size_t i = 2 + rng.below(8); i > 0; i--) {
+        out += op(rng) + literal(rng);
+    }
+    out += ";\n";
+}
+
+// What our generated sources actually look like: deep indentation and more comment than code
+void comment_heavy(Random& rng, std::string& out) {
+    std::string indent(4 * (1 + rng.below(8)), ' ');
+    out += indent + "// " + identifier(rng) + " " + identifier(rng) + " " + literal(rng) + " generated, do not edit\n";
+    if (rng.below(3) == 0) {
+        out += indent + "/*\n";
+        for (size_t i = 1 + rng.below(6); i > 0; i--) {
+            out += indent + " * " + identifier(rng) + " " + identifier(rng) + " " + identifier(rng) + "\n";
+        }
+        out += indent + " */\n";
+    }
+    out += indent + "let " + identifier(rng) + " = " + literal(rng) + ";\n";
+}
+
+// Deep parens and scopes, lots of single char tokens back to back
+void deeply_nested(Random& rng, std::string& out) {
+    size_t depth = 8 + rng.below(24);
+    out += "let " + identifier(rng) + " = ";
+    for (size_t i = 0; i < depth; i++) {
+        out += "(";
+    }
+    out += literal(rng);
+    for (size_t i = 0; i < depth; i++) {
+        out += op(rng) + literal(rng) + ")";
+    }
+    out += ";\n";
+    size_t scopes = 1 + rng.below(16);
+    for (size_t i = 0; i < scopes; i++) {
+        out += "if (x) {";
+    }
+    out += "x = 1;";
+    for (size_t i = 0; i < scopes; i++) {
+        out += "}";
+    }
+    out += "\n";
+}
+
+struct Shape {
+    const char* name;
+    void (*statement)(Random&, std::string&);
+};
+
+std::string make_corpus(const Shape& shape, size_t bytes) {
+    Random rng(0x9E3779B97F4A7C15ull);
+    std::string src;
+    src.reserve(bytes + 4096);
+    while (src.size() < bytes) {
+        shape.statement(rng, src);
+    }
+    return src;
+}
+
+int main(int argc, char** argv) {
+    std::vector<size_t> sizes_mb;
+    for (int i = 1; i < argc; i++) {
+        sizes_mb.push_back(std::strtoul(argv[i], nullptr, 10));
+    }
+    if (sizes_mb.empty()) {
+        sizes_mb = {1, 10, 100};
+    }
+
+    const Shape shapes[] = {
+        {"identifiers", identifier_heavy},
+        {"literals", literal_heavy},
+        {"comments", comment_heavy},
+        {"nested", deeply_nested},
+    };
+
+#ifndef __OPTIMIZE__
+    std::cerr << "Warning: built without optimizations, configure with -DCMAKE_BUILD_TYPE=Release for real numbers" << std::endl;
+#endif
+
+    std::cout << std::left << std::setw(14) << "shape" << std::right << std::setw(8) << "MB"
+              << std::setw(12) << "MB/s" << std::setw(14) << "Mtokens/s" << std::setw(14) << "allocs/token" << "\n";
+    for (const Shape& shape : shapes) {
+        for (size_t mb : sizes_mb) {
+            std::string src = make_corpus(shape, mb * 1024 * 1024);
+
+            // Smaller corpora go round a few times so the timer has something to measure
+            size_t reps = std::max<size_t>(1, 100 / std::max<size_t>(1, mb));
+            size_t tokens = 0;
+            size_t allocations = 0;
+            auto start = std::chrono::steady_clock::now();
+            for (size_t rep = 0; rep < reps; rep++) {
+                Interner interner;
+                size_t before = g_allocations;
+                TokenStore store = Tokenizer(src, interner).tokenize();
+                allocations += g_allocations - before;
+                tokens += store.size();
+            }
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            double total_mb = double(src.size()) * reps / (1024 * 1024);
+            std::cout << std::left << std::setw(14) << shape.name << std::right << std::setw(8) << mb
+                      << std::fixed << std::setprecision(1) << std::setw(12) << total_mb / seconds
+                      << std::setw(14) << tokens / seconds / 1e6
+                      << std::setprecision(4) << std::setw(14) << double(allocations) / std::max<size_t>(1, tokens)
+                      << "\n";
+        }
+    }
+    return EXIT_SUCCESS;
+}
@@ -2,35 +2,421 @@
 
 #pragma once
 
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <sys/mman.h>
+
+/*
+ * Bump allocator for the AST. Memory comes in chunks: we start with one small chunk and every time we run out we grab
+ * a new one twice the size of the last, so small programs stay small and big ones never run off the end of a fixed
+ * buffer. Chunks of 2MB and up come straight from mmap and get marked for transparent huge pages, which saves a lot
+ * of TLB misses when walking a big tree.
+ * Nothing gets freed one by one. reset() rewinds to the first chunk and keeps every chunk around for the next
+ * compilation, and everything goes back to the OS when the arena dies.
+ *
+ * Blocks that keep growing (the pools in ArenaArray) are the exception. Only the newest block can grow in place, so
+ * with a dozen pools growing side by side most growth would be a copy, leaving the old block dead until the next
+ * reset. Once a block grows past own_chunk_size it gets a mapping of its own instead, which mremap can make bigger
+ * without copying and without leaving anything behind.
+ */
 class ArenaAllocator {
 
 public:
-    inline explicit ArenaAllocator(size_t bytes)
-        : m_size(bytes)
+    // Blocks that grow to at least this get a chunk of their own. Below it, all the copies a block left behind on the
+    // way up add up to less than this
+    static constexpr size_t own_chunk_size = 64 * 1024;
+
+    inline explicit ArenaAllocator(size_t first_chunk_bytes = 64 * 1024)
+        : m_next_chunk_size(std::max<size_t>(first_chunk_bytes, 64))
+    {
+    }
+
+    inline ~ArenaAllocator()
     {
-        m_buffer = (std::byte*) (malloc(m_size));
-        // Offset at start of buffer
-        m_offset = m_buffer;
+        for (const Chunk& chunk : m_chunks) {
+            release(chunk);
+        }
+        for (const OwnChunk& own : m_own_chunks) {
+            munmap(own.begin, own.size);
+        }
     }
 
+    // Chunks are owned by exactly one arena
+    ArenaAllocator(const ArenaAllocator&) = delete;
+    ArenaAllocator& operator=(const ArenaAllocator&) = delete;
+
     // Use a template so we can know type of object we are allocating, instead of doing sizeof()
-    template<typename T>
-    inline T* alloc() {
-        void* offset = m_offset;
-        m_offset += sizeof(T);
-        return (T*) offset;
+    // The object gets constructed in place, so a node that comes back from here starts out zeroed/defaulted
+    template<typename T, typename... Args>
+    inline T* alloc(Args&&... args) {
+        static_assert(std::is_trivially_destructible_v<T>, "the arena never runs destructors");
+        void* memory = alloc_bytes(sizeof(T), alignof(T));
+        return new (memory) T(std::forward<Args>(args)...);
     }
 
-    inline ~ArenaAllocator()
-    {
-        free(m_buffer);
+    // Make block (old_size bytes, from alloc_bytes or an earlier grow) new_size bytes long, handing back where it ended
+    // up. Big blocks get a chunk of their own, see grow_own. Otherwise the newest block just grows in place when its
+    // chunk has room, and anything else gets copied to a new block, and the old one is dead until the next reset
+    inline void* grow(void* block, size_t old_size, size_t new_size, size_t align) {
+        if (new_size >= own_chunk_size && align <= page_size) {
+            return grow_own(block, old_size, new_size);
+        }
+        if (block != nullptr && (std::byte*) block + old_size == m_offset && m_current < m_chunks.size()) {
+            const Chunk& chunk = m_chunks[m_current];
+            if ((std::byte*) block + new_size <= chunk.begin + chunk.size) {
+                m_used += new_size - old_size;
+                m_high_water = std::max(m_high_water, m_used);
+                m_offset = (std::byte*) block + new_size;
+                return block;
+            }
+        }
+        void* moved = alloc_bytes(new_size, align);
+        if (old_size > 0) {
+            std::memcpy(moved, block, old_size);
+            discard(block, old_size);
+        }
+        return moved;
+    }
+
+    // Raw memory, aligned to align (which has to be a power of 2)
+    inline void* alloc_bytes(size_t size, size_t align) {
+        while (true) {
+            if (m_current < m_chunks.size()) {
+                const Chunk& chunk = m_chunks[m_current];
+                uintptr_t start = (uintptr_t(m_offset) + align - 1) & ~uintptr_t(align - 1);
+                if (start + size <= uintptr_t(chunk.begin + chunk.size)) {
+                    m_used += start + size - uintptr_t(m_offset);
+                    m_high_water = std::max(m_high_water, m_used);
+                    m_offset = (std::byte*) (start + size);
+                    return (void*) start;
+                }
+            }
+            next_chunk(size + align);
+        }
+    }
+
+    // Rewind so the memory can be handed out again. Anything allocated before this is dead
+    inline void reset() {
+        m_current = 0;
+        m_offset = m_chunks.empty() ? nullptr : m_chunks[0].begin;
+        m_used = 0;
+        for (OwnChunk& own : m_own_chunks) {
+            own.in_use = false;
+        }
+    }
+
+    // Bytes handed out since the last reset, counting alignment padding and chunk tails we skipped
+    inline size_t bytes_used() const {
+        return m_used;
+    }
+
+    // Most bytes_used() has ever been, across resets
+    inline size_t high_water() const {
+        return m_high_water;
+    }
+
+    // Everything we are holding onto from the OS
+    inline size_t bytes_reserved() const {
+        size_t total = 0;
+        for (const Chunk& chunk : m_chunks) {
+            total += chunk.size;
+        }
+        for (const OwnChunk& own : m_own_chunks) {
+            total += own.size;
+        }
+        return total;
     }
+
 private:
-    size_t m_size;
-    // Instead of typeless void*, make a byte buffer
-    std::byte* m_buffer;
-    std::byte* m_offset;
+    struct Chunk {
+        std::byte* begin;
+        size_t size;
+        bool mapped;
+    };
+
+    // A mapping holding one block, that block grows by growing the mapping. Kept after a reset for the next big block
+    struct OwnChunk {
+        std::byte* begin;
+        size_t size;
+        bool in_use;
+    };
+
+    // Chunks at least this big get mmapped and backed by huge pages
+    static constexpr size_t huge_page_size = 2 * 1024 * 1024;
+
+    // Blocks at least this big hand their pages back to the OS once they are dead
+    static constexpr size_t discard_size = 256 * 1024;
+    static constexpr size_t page_size = 4096;
+
+    // A dead block's memory stays in the arena until the next reset, but the whole pages in a big one don't need to
+    // stay resident. MADV_DONTNEED drops them, and they come back as zeroes if we ever touch them again
+    static inline void discard(void* block, size_t size) {
+        if (size < discard_size) {
+            return;
+        }
+        uintptr_t begin = (uintptr_t(block) + page_size - 1) & ~uintptr_t(page_size - 1);
+        uintptr_t end = (uintptr_t(block) + size) & ~uintptr_t(page_size - 1);
+        madvise((void*) begin, end - begin, MADV_DONTNEED);
+    }
+
+    // Move on to the next chunk that can hold at least min_size bytes, making a new one if we have to
+    inline void next_chunk(size_t min_size) {
+        // Whatever is left in the chunk we are leaving is wasted, count it as used so the stats add up
+        if (m_current < m_chunks.size()) {
+            const Chunk& chunk = m_chunks[m_current];
+            m_used += chunk.begin + chunk.size - m_offset;
+        }
+        // After a reset there may already be chunks past this one we can reuse
+        for (m_current++; m_current < m_chunks.size(); m_current++) {
+            if (m_chunks[m_current].size >= min_size) {
+                m_offset = m_chunks[m_current].begin;
+                return;
+            }
+            m_used += m_chunks[m_current].size;
+        }
+
+        size_t size = std::max(m_next_chunk_size, min_size);
+        m_next_chunk_size = size * 2;
+        m_chunks.push_back(acquire(size));
+        m_current = m_chunks.size() - 1;
+        m_offset = m_chunks.back().begin;
+    }
+
+    static inline Chunk acquire(size_t size) {
+        if (size >= huge_page_size) {
+            size = (size + huge_page_size - 1) & ~(huge_page_size - 1);
+            void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (memory != MAP_FAILED) {
+#ifdef MADV_HUGEPAGE
+                madvise(memory, size, MADV_HUGEPAGE);
+#endif
+                return {(std::byte*) memory, size, true};
+            }
+        }
+        // Instead of typeless void*, make a byte buffer
+        auto* memory = (std::byte*) malloc(size);
+        if (memory == nullptr) {
+            throw std::bad_alloc();
+        }
+        return {memory, size, false};
+    }
+
+    // Grow block into, or inside, a chunk of its own
+    inline void* grow_own(void* block, size_t old_size, size_t new_size) {
+        size_t size = (new_size + page_size - 1) & ~(page_size - 1);
+        OwnChunk* own = nullptr;
+        for (OwnChunk& chunk : m_own_chunks) {
+            if (chunk.in_use && chunk.begin == block) {
+                own = &chunk;
+            }
+        }
+        if (own == nullptr) {
+            // Moving out of a bump chunk. Take back a chunk from before the last reset if there is one: the smallest
+            // that is big enough, or else the biggest. It gets cut or grown to size, so the chunks we hold never add
+            // up to more than the blocks in them did
+            for (OwnChunk& chunk : m_own_chunks) {
+                if (chunk.in_use) {
+                    continue;
+                }
+                bool better = own == nullptr;
+                if (!better && chunk.size >= size) {
+                    better = own->size < size || chunk.size < own->size;
+                } else if (!better) {
+                    better = own->size < size && chunk.size > own->size;
+                }
+                if (better) {
+                    own = &chunk;
+                }
+            }
+            if (own == nullptr) {
+                m_own_chunks.push_back({map_own(size), size, false});
+                own = &m_own_chunks.back();
+            }
+            own->in_use = true;
+            if (own->size != size) {
+                remap_own(*own, size, 0);
+            }
+            if (old_size > 0) {
+                std::memcpy(own->begin, block, old_size);
+                discard(block, old_size);
+            }
+        } else if (own->size < size) {
+            remap_own(*own, size, old_size);
+        }
+        m_used += new_size - old_size;
+        m_high_water = std::max(m_high_water, m_used);
+        return own->begin;
+    }
+
+    static inline std::byte* map_own(size_t size) {
+        void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+#ifdef MADV_HUGEPAGE
+        if (size >= huge_page_size) {
+            madvise(memory, size, MADV_HUGEPAGE);
+        }
+#endif
+        return (std::byte*) memory;
+    }
+
+    // Make own size bytes, keeping the first used of them. mremap just moves the pages over, elsewhere we copy
+    static inline void remap_own(OwnChunk& own, size_t size, [[maybe_unused]] size_t used) {
+#ifdef MREMAP_MAYMOVE
+        void* memory = mremap(own.begin, own.size, size, MREMAP_MAYMOVE);
+        if (memory == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+#ifdef MADV_HUGEPAGE
+        if (size >= huge_page_size) {
+            madvise(memory, size, MADV_HUGEPAGE);
+        }
+#endif
+#else
+        std::byte* memory = map_own(size);
+        std::memcpy(memory, own.begin, used);
+        munmap(own.begin, own.size);
+#endif
+        own.begin = (std::byte*) memory;
+        own.size = size;
+    }
+
+    static inline void release(const Chunk& chunk) {
+        if (chunk.mapped) {
+            munmap(chunk.begin, chunk.size);
+        } else {
+            free(chunk.begin);
+        }
+    }
+
+    std::vector<Chunk> m_chunks;
+    std::vector<OwnChunk> m_own_chunks;
+    // Chunk we are bumping through, and where in it the next allocation goes
+    size_t m_current = 0;
+    std::byte* m_offset = nullptr;
+    size_t m_next_chunk_size;
+
+    size_t m_used = 0;
+    size_t m_high_water = 0;
 
 };
 
 
+/*
+ * Growable array that lives in an arena, what the AST's pools are made of. It works like a std::vector of trivial
+ * things, except the memory comes out of arena: growing asks the arena for a block twice the size (which it can often
+ * just extend in place) and nothing is ever freed on its own. clear() keeps the block to fill again, reset() forgets
+ * it, which is what has to happen when the arena gets reset underneath us.
+ * Holds a pointer into the arena, so it can't be copied.
+ */
+template<typename T>
+class ArenaArray {
+public:
+    static_assert(std::is_trivially_copyable_v<T> && std::is_trivially_destructible_v<T>, "arena arrays get memcpy'd and never destroyed");
+    using value_type = T;
+
+    inline explicit ArenaArray(ArenaAllocator& arena)
+        : m_arena(&arena)
+    {
+    }
+
+    ArenaArray(const ArenaArray&) = delete;
+    ArenaArray& operator=(const ArenaArray&) = delete;
+
+    inline T* begin() const {
+        return m_data;
+    }
+
+    inline T* end() const {
+        return m_data + m_size;
+    }
+
+    inline T* data() const {
+        return m_data;
+    }
+
+    inline size_t size() const {
+        return m_size;
+    }
+
+    inline bool empty() const {
+        return m_size == 0;
+    }
+
+    inline T& operator[](size_t i) const {
+        return m_data[i];
+    }
+
+    inline T& back() const {
+        return m_data[m_size - 1];
+    }
+
+    inline void push_back(const T& value) {
+        if (m_size == m_capacity) {
+            grow(m_size + 1);
+        }
+        m_data[m_size++] = value;
+    }
+
+    // Anything new starts out zeroed/defaulted, reused arena memory isn't
+    inline void resize(size_t size) {
+        if (size > m_capacity) {
+            grow(size);
+        }
+        for (size_t i = m_size; i < size; i++) {
+            new (&m_data[i]) T();
+        }
+        m_size = size;
+    }
+
+    // Tack count things onto the end
+    inline void append(const T* items, size_t count) {
+        if (m_size + count > m_capacity) {
+            grow(m_size + count);
+        }
+        if (count > 0) {
+            std::memcpy(m_data + m_size, items, sizeof(T) * count);
+        }
+        m_size += count;
+    }
+
+    inline void append(const ArenaArray& other) {
+        append(other.m_data, other.m_size);
+    }
+
+    // Empty, but keep the block to fill again
+    inline void clear() {
+        m_size = 0;
+    }
+
+    // Empty and let go of the block, for when the arena gets reset and it isn't ours anymore
+    inline void reset() {
+        m_data = nullptr;
+        m_size = 0;
+        m_capacity = 0;
+    }
+
+private:
+    inline void grow(size_t min_capacity) {
+        // Doubling keeps the copies down while we are small. Once we are in a chunk of our own growing doesn't copy
+        // anything, so there it is better to grow a little at a time and not hold twice what we need
+        size_t step = sizeof(T) * m_capacity >= ArenaAllocator::own_chunk_size ? m_capacity / 8 : m_capacity;
+        size_t capacity = std::max<size_t>({min_capacity, m_capacity + step, 16});
+        m_data = (T*) m_arena->grow(m_data, sizeof(T) * m_capacity, sizeof(T) * capacity, alignof(T));
+        m_capacity = capacity;
+    }
+
+    ArenaAllocator* m_arena;
+    T* m_data = nullptr;
+    size_t m_size = 0;
+    size_t m_capacity = 0;
+};
@@ -0,0 +1,776 @@
+// File for the on-disk cache of parsed programs
+
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include <elf.h>
+#include <fcntl.h>
+#include <link.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "interner.hpp"
+#include "parser.hpp"
+#include "sha256.hpp"
+
+// 64 bit hash that eats 8 bytes at a time. Fine for catching a file that got mangled, but two sources it can't tell
+// apart are easy to make, so what a cache file was made from is checked with sha256() instead
+inline uint64_t hash_bytes(const void* data, size_t size, uint64_t seed) {
+    constexpr uint64_t prime = 0x9e3779b97f4a7c15ull;
+    const char* p = static_cast<const char*>(data);
+    uint64_t hash = seed ^ (size * prime);
+    auto mix = [&](uint64_t word) {
+        hash = (hash ^ word) * prime;
+        hash ^= hash >> 29;
+    };
+    for (; size >= 8; size -= 8, p += 8) {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        mix(word);
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, p, size);
+    mix(tail);
+    hash ^= hash >> 32;
+    return hash * prime;
+}
+
+/*
+ * Every pool in a NodeProg, in the order they sit in a cache file. One list for reading and writing so they can't
+ * disagree. The pools are plain arrays of ints and small structs with indices instead of pointers, so they mean the
+ * same thing wherever they end up in memory.
+ * A payload pool comes with the kinds that say what each payload is (always a pool that comes before it), since
+ * payloads of different kinds are indices into different pools and only make sense next to others of the same kind.
+ */
+template <class Prog, class Visit>
+inline void visit_pools(Prog& prog, Visit&& visit) {
+    visit(prog.stmt_kinds);
+    visit(prog.stmt_payloads, prog.stmt_kinds);
+    visit(prog.stmt_next);
+    visit(prog.lets);
+    visit(prog.assigns);
+    visit(prog.scopes);
+    visit(prog.ifs);
+    visit(prog.pred_kinds);
+    visit(prog.pred_payloads, prog.pred_kinds);
+    visit(prog.elifs);
+    visit(prog.exprs.expr_kinds);
+    visit(prog.exprs.expr_payloads, prog.exprs.expr_kinds);
+    visit(prog.exprs.expr_types);
+    visit(prog.exprs.term_kinds);
+    visit(prog.exprs.term_payloads, prog.exprs.term_kinds);
+    visit(prog.exprs.int_lits);
+    visit(prog.exprs.bins);
+}
+
+// Every field of one node in a pool, in order, the node itself if it's just a number. The fields get bound by name,
+// so a node that grows a field won't compile until it's listed here too
+template <class Node, class Visit>
+constexpr void visit_fields(Node& node, Visit&& visit) {
+    using Type = std::remove_const_t<Node>;
+    if constexpr (std::is_integral_v<Type> || std::is_enum_v<Type>) {
+        visit(node);
+    } else if constexpr (std::is_same_v<Type, NodeBinExpr>) {
+        auto& [lhs, rhs, op, int_or_float] = node;
+        visit(lhs);
+        visit(rhs);
+        visit(op);
+        visit(int_or_float);
+    } else if constexpr (std::is_same_v<Type, NodeStmtLet>) {
+        auto& [ident, expr, int_or_float] = node;
+        visit(ident);
+        visit(expr);
+        visit(int_or_float);
+    } else if constexpr (std::is_same_v<Type, NodeStmtAssign>) {
+        auto& [ident, expr] = node;
+        visit(ident);
+        visit(expr);
+    } else if constexpr (std::is_same_v<Type, NodeScope>) {
+        auto& [first, end] = node;
+        visit(first);
+        visit(end);
+    } else if constexpr (std::is_same_v<Type, NodeStmtIf> || std::is_same_v<Type, NodeIfPredElif>) {
+        auto& [expr, scope, pred] = node;
+        visit(expr);
+        visit(scope);
+        visit(pred);
+    } else {
+        static_assert(sizeof(Type) == 0, "list the fields of every node that has a pool");
+    }
+}
+
+// GNU build id of whatever we got linked into (the linker hashes the code to make it, so every build of the compiler
+// has a different one), empty if the linker didn't leave one
+inline std::string build_id() {
+    struct Search {
+        uintptr_t address;
+        std::string id;
+    } search {reinterpret_cast<uintptr_t>(&build_id), {}};
+    dl_iterate_phdr([](dl_phdr_info* info, size_t, void* data) -> int {
+        auto* search = static_cast<Search*>(data);
+        bool ours = false;
+        for (int i = 0; i < info->dlpi_phnum; i++) {
+            const ElfW(Phdr)& segment = info->dlpi_phdr[i];
+            uintptr_t start = info->dlpi_addr + segment.p_vaddr;
+            ours |= segment.p_type == PT_LOAD && search->address >= start && search->address < start + segment.p_memsz;
+        }
+        if (!ours) {
+            return 0;
+        }
+        for (int i = 0; i < info->dlpi_phnum; i++) {
+            const ElfW(Phdr)& segment = info->dlpi_phdr[i];
+            if (segment.p_type != PT_NOTE) {
+                continue;
+            }
+            const char* note = reinterpret_cast<const char*>(info->dlpi_addr + segment.p_vaddr);
+            const char* end = note + segment.p_memsz;
+            while (note + sizeof(ElfW(Nhdr)) <= end) {
+                ElfW(Nhdr) header;
+                memcpy(&header, note, sizeof(header));
+                const char* name = note + sizeof(header);
+                const char* desc = name + ((header.n_namesz + 3) & ~3u);
+                if (header.n_type == NT_GNU_BUILD_ID && header.n_namesz == 4 && memcmp(name, "GNU", 4) == 0) {
+                    search->id.assign(desc, header.n_descsz);
+                    return 1;
+                }
+                note = desc + ((header.n_descsz + 3) & ~3u);
+            }
+        }
+        return 1;
+    }, &search);
+    return search.id;
+}
+
+/*
+ * Which compiler a cache file is for. A tree is only any good to the build that wrote it: the parser can change what
+ * it makes without the layout changing, and the layout can change under a parser that didn't. So this is the build id
+ * (or when we were compiled, without one), along with the size and offset of every field of every pool, which would
+ * catch a tree written by the same code built for a different target.
+ */
+inline uint64_t cache_format() {
+    static const uint64_t format = [] {
+        std::vector<uint64_t> layout;
+        NodeProg prog;
+        visit_pools(prog, [&](auto& pool, auto&...) {
+            using Node = typename std::decay_t<decltype(pool)>::value_type;
+            Node node {};
+            layout.push_back(sizeof(Node));
+            layout.push_back(alignof(Node));
+            visit_fields(node, [&](auto& field) {
+                layout.push_back(reinterpret_cast<const char*>(&field) - reinterpret_cast<const char*>(&node));
+                layout.push_back(sizeof(field));
+            });
+        });
+        std::string build = build_id();
+        if (build.empty()) {
+            build = __DATE__ " " __TIME__;
+        }
+        uint64_t seed = hash_bytes(layout.data(), layout.size() * sizeof(uint64_t), 0);
+        return hash_bytes(build.data(), build.size(), seed);
+    }();
+    return format;
+}
+
+/*
+ * Parsed programs saved on disk, so compiling a source we have seen before skips the tokenizer and parser.
+ * Each program is one file in the cache directory, named after the sha256() of the source and the cache_format(). It
+ * holds a header with both of those in it, the identifier names (the tree only has SymbolIds), and then every pool in
+ * visit_pools order. A checksum over all of that catches files that got cut short or mangled.
+ *
+ * Pools get written block_size nodes at a time, and in a block one field at a time: each value as how far it is from
+ * the same field in the node before (zigzagged, so small steps back are small too), all packed at the bit width of
+ * the biggest one. Ids in preorder mostly go up by a little each node, so most fields take 2 or 3 bits instead of 32.
+ * A payload goes from the last payload of the same kind instead, which is what keeps those small too. Fields that
+ * don't count up, like the kinds, would rather be packed as they are or as indices into a table of the few values
+ * they take, so each block picks whichever of the three is smallest.
+ * That makes a file somewhere between a third of the size of the source and a bit under it, and around a tenth of
+ * the size of the pools.
+ *
+ * Reading one back maps the file and decodes the pools out of it, the names stay where they are in the mapping, so
+ * the mapping lives until the next load. What comes out gets checked to be a tree Generator can walk (check_tree)
+ * before anything uses it. Writing goes to a temporary file that gets renamed into place, so two
+ * compiles of the same source at once can't see half a file. The cache is only ever an optimization: anything going
+ * wrong with it just means we parse like normal.
+ */
+class AstCache {
+public:
+    inline AstCache() = default;
+
+    inline ~AstCache()
+    {
+        unmap();
+    }
+
+    // The interner hands out views into our mapping
+    AstCache(const AstCache&) = delete;
+    AstCache& operator=(const AstCache&) = delete;
+
+    // Fills prog and interner (which must be empty) with what was saved for the source with this sha256(), false if
+    // there is nothing usable
+    inline bool load(const std::string& dir, const Sha256Digest& source, NodeProg& prog, Interner& interner) {
+        unmap();
+        int fd = open(path(dir, source).c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st {};
+        if (fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(Header)) {
+            close(fd);
+            return false;
+        }
+        void* mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (mapping == MAP_FAILED) {
+            return false;
+        }
+        m_mapping = mapping;
+        m_size = st.st_size;
+
+        const char* file = static_cast<const char*>(m_mapping);
+        Header header;
+        memcpy(&header, file, sizeof(header));
+        if (header.magic != magic || header.format != cache_format() || header.source != source
+            || header.body_size != m_size - sizeof(Header)
+            || hash_bytes(file + sizeof(Header), header.body_size, header.format) != header.checksum
+            || !read_body(file + sizeof(Header), file + m_size, header.names, prog, interner)) {
+            unmap();
+            prog.clear();
+            interner.clear();
+            return false;
+        }
+        return true;
+    }
+
+    // Save prog for the source with this sha256(). Failing to is fine, the next compile just misses
+    inline void store(const std::string& dir, const Sha256Digest& source, const NodeProg& prog, const Interner& interner) {
+        std::string body;
+        for (SymbolId id = 0; id < interner.size(); id++) {
+            put_varint(body, interner.name(id).size());
+        }
+        for (SymbolId id = 0; id < interner.size(); id++) {
+            body.append(interner.name(id));
+        }
+        visit_pools(prog, [&](const auto& pool, const auto&... kinds) {
+            put_pool(body, pool, kinds...);
+        });
+
+        Header header {
+            .magic = magic,
+            .format = cache_format(),
+            .source = source,
+            .body_size = body.size(),
+            .checksum = hash_bytes(body.data(), body.size(), cache_format()),
+            .names = interner.size(),
+        };
+
+        mkdir(dir.c_str(), 0777);
+        std::string final_path = path(dir, source);
+        std::string temp_path = final_path + ".XXXXXX";
+        int fd = mkstemp(temp_path.data());
+        if (fd < 0) {
+            return;
+        }
+        // mkstemp makes it readable by us alone, but a cache directory can be shared
+        fchmod(fd, 0644);
+        bool written = write_all(fd, &header, sizeof(header)) && write_all(fd, body.data(), body.size());
+        close(fd);
+        if (!written || rename(temp_path.c_str(), final_path.c_str()) != 0) {
+            unlink(temp_path.c_str());
+        }
+    }
+
+private:
+    // "hydroast", once it's in the file
+    static constexpr uint64_t magic = 0x7473616f72647968ull;
+
+    struct Header {
+        uint64_t magic;
+        uint64_t format;
+        Sha256Digest source;
+        uint64_t body_size;
+        uint64_t checksum;
+        uint64_t names;
+    };
+
+    static inline std::string path(const std::string& dir, const Sha256Digest& source) {
+        uint64_t key = hash_bytes(source.data(), source.size(), cache_format());
+        char name[32];
+        snprintf(name, sizeof(name), "/%016llx.ast", static_cast<unsigned long long>(key));
+        return dir + name;
+    }
+
+    // Nodes in a block, and the most fields a node can have
+    static constexpr size_t block_size = 64;
+    static constexpr size_t max_fields = 4;
+
+    // A field as an unsigned number as wide as it is, so differences between two of them wrap around at its width
+    template <class Field>
+    static inline auto field_bits(Field field) {
+        if constexpr (std::is_enum_v<Field>) {
+            return std::make_unsigned_t<std::underlying_type_t<Field>>(field);
+        } else {
+            return std::make_unsigned_t<Field>(field);
+        }
+    }
+
+    template <class Node>
+    static constexpr size_t field_count() {
+        Node blank {};
+        size_t count = 0;
+        visit_fields(blank, [&](auto&) { count++; });
+        return count;
+    }
+
+    // Which of the last values a field in node i counts from, one per kind for payloads. Kinds are all uint8_t enums
+    template <class... Kinds>
+    static inline size_t kind_of([[maybe_unused]] size_t i, const Kinds&... kinds) {
+        size_t kind = 0;
+        ((kind = field_bits(kinds[i])), ...);
+        return kind;
+    }
+
+    static inline int bit_width(uint64_t value) {
+        return value == 0 ? 0 : 64 - __builtin_clzll(value);
+    }
+
+    static inline void put_varint(std::string& body, uint64_t value) {
+        while (value >= 0x80) {
+            body.push_back(char(value | 0x80));
+            value >>= 7;
+        }
+        body.push_back(char(value));
+    }
+
+    // Reads one varint, nullptr if it runs off the end
+    static inline const char* get_varint(const char* p, const char* end, uint64_t& value) {
+        value = 0;
+        for (int shift = 0; p < end && shift < 64; shift += 7) {
+            uint8_t byte = *p++;
+            value |= uint64_t(byte & 0x7F) << shift;
+            if (byte < 0x80) {
+                return p;
+            }
+        }
+        return nullptr;
+    }
+
+    // block_size values of width bits each, which is exactly width 8 byte words
+    static inline void pack(std::string& body, const uint64_t* values, int width) {
+        uint64_t words[block_size];
+        std::fill(words, words + width, 0);
+        for (size_t i = 0; i < block_size; i++) {
+            size_t bit = i * width;
+            words[bit / 64] |= values[i] << (bit % 64);
+            if (bit % 64 + width > 64) {
+                words[bit / 64 + 1] |= values[i] >> (64 - bit % 64);
+            }
+        }
+        body.append(reinterpret_cast<const char*>(words), width * 8);
+    }
+
+    static inline void unpack(const char* p, int width, uint64_t* values) {
+        if (width == 0) {
+            std::fill(values, values + block_size, 0);
+            return;
+        }
+        // One more word so a value can always take its high bits from the next one, even when there aren't any
+        uint64_t words[block_size + 1];
+        memcpy(words, p, width * 8);
+        words[width] = 0;
+        uint64_t mask = width == 64 ? ~uint64_t(0) : (uint64_t(1) << width) - 1;
+        for (size_t i = 0; i < block_size; i++) {
+            size_t bit = i * width;
+            uint64_t low = words[bit / 64] >> (bit % 64);
+            // Shifting by 64 isn't a thing, so do it as 63 and then 1
+            uint64_t high = words[bit / 64 + 1] << (63 - bit % 64) << 1;
+            values[i] = (low | high) & mask;
+        }
+    }
+
+    // How one field of a block is written, which goes in its first byte along with the bit width
+    enum class BlockMode : uint8_t {
+        // Zigzagged differences from the last value
+        deltas,
+        // The values as they are
+        values,
+        // At most table_size different values, a byte saying how many, those as varints, and then an index into them
+        // for each value. Mostly for int_or_float, which is one of two TokenTypes that are 16 apart
+        table,
+    };
+    static constexpr size_t table_size = 4;
+
+    // The narrowest way to write a block of one field. deltas and values must be zero past count
+    static inline void put_block(std::string& body, const uint64_t* values, const uint64_t* deltas, size_t count) {
+        uint64_t all_values = 0;
+        uint64_t all_deltas = 0;
+        for (size_t i = 0; i < block_size; i++) {
+            all_values |= values[i];
+            all_deltas |= deltas[i];
+        }
+        int value_width = bit_width(all_values);
+        int delta_width = bit_width(all_deltas);
+
+        uint64_t table[table_size];
+        size_t entries = 0;
+        uint64_t indices[block_size] = {};
+        for (size_t i = 0; i < count && entries <= table_size; i++) {
+            size_t index = std::find(table, table + entries, values[i]) - table;
+            if (index == entries && entries < table_size) {
+                table[entries++] = values[i];
+            } else if (index == entries) {
+                entries = table_size + 1;
+            }
+            indices[i] = index;
+        }
+        std::string table_bytes;
+        int index_width = bit_width(entries - 1);
+        if (entries <= table_size) {
+            table_bytes.push_back(char(entries));
+            for (size_t i = 0; i < entries; i++) {
+                put_varint(table_bytes, table[i]);
+            }
+        }
+
+        size_t delta_size = delta_width * 8;
+        size_t value_size = value_width * 8;
+        if (entries <= table_size && table_bytes.size() + index_width * 8 < std::min(delta_size, value_size)) {
+            put_block_mode(body, BlockMode::table, index_width);
+            body.append(table_bytes);
+            pack(body, indices, index_width);
+        } else if (value_size < delta_size) {
+            put_block_mode(body, BlockMode::values, value_width);
+            pack(body, values, value_width);
+        } else {
+            put_block_mode(body, BlockMode::deltas, delta_width);
+            pack(body, deltas, delta_width);
+        }
+    }
+
+    static inline void put_block_mode(std::string& body, BlockMode mode, int width) {
+        body.push_back(char(int(mode) * 65 + width));
+    }
+
+    // Unpacks a block of one field into values, which are deltas if it says so. nullptr if it doesn't fit in what's left
+    static inline const char* get_block(const char* p, const char* end, uint64_t* values, bool& deltas) {
+        if (p == end) {
+            return nullptr;
+        }
+        uint8_t mode = uint8_t(*p) / 65;
+        int width = uint8_t(*p) % 65;
+        p++;
+        uint64_t table[table_size];
+        size_t entries = 0;
+        if (mode == uint8_t(BlockMode::table)) {
+            entries = p < end ? uint8_t(*p++) : 0;
+            if (entries == 0 || entries > table_size || width != bit_width(entries - 1)) {
+                return nullptr;
+            }
+            for (size_t i = 0; i < entries && p != nullptr; i++) {
+                p = get_varint(p, end, table[i]);
+            }
+        } else if (mode > uint8_t(BlockMode::table)) {
+            return nullptr;
+        }
+        if (p == nullptr || width * 8 > end - p) {
+            return nullptr;
+        }
+        unpack(p, width, values);
+        p += width * 8;
+        if (mode == uint8_t(BlockMode::table)) {
+            for (size_t i = 0; i < block_size; i++) {
+                // An index past the table can only be in a file we didn't write
+                values[i] = values[i] < entries ? table[values[i]] : 0;
+            }
+        }
+        deltas = mode == uint8_t(BlockMode::deltas);
+        return p;
+    }
+
+    // A block for each field of every block_size nodes
+    template <class Pool, class... Kinds>
+    static inline void put_pool(std::string& body, const Pool& pool, const Kinds&... kinds) {
+        using Node = typename Pool::value_type;
+        constexpr size_t fields = field_count<Node>();
+        static_assert(fields <= max_fields);
+        put_varint(body, pool.size());
+        std::vector<uint64_t> before(fields << 8);
+        for (size_t start = 0; start < pool.size(); start += block_size) {
+            size_t count = std::min(block_size, pool.size() - start);
+            uint64_t values[max_fields][block_size] = {};
+            uint64_t deltas[max_fields][block_size] = {};
+            for (size_t i = 0; i < count; i++) {
+                size_t kind = kind_of(start + i, kinds...);
+                size_t field = 0;
+                visit_fields(pool[start + i], [&](const auto& value) {
+                    auto bits = field_bits(value);
+                    using Bits = decltype(bits);
+                    using Signed = std::make_signed_t<Bits>;
+                    uint64_t& last = before[field << 8 | kind];
+                    int64_t delta = Signed(Bits(bits - Bits(last)));
+                    last = bits;
+                    values[field][i] = bits;
+                    deltas[field][i] = uint64_t(delta) << 1 ^ uint64_t(delta >> 63);
+                    field++;
+                });
+            }
+            for (size_t field = 0; field < fields; field++) {
+                put_block(body, values[field], deltas[field], count);
+            }
+        }
+    }
+
+    // nullptr if the pool doesn't fit in what's left
+    template <class Pool, class... Kinds>
+    static inline const char* get_pool(const char* p, const char* end, Pool& pool, const Kinds&... kinds) {
+        using Node = typename Pool::value_type;
+        constexpr size_t fields = field_count<Node>();
+        uint64_t count;
+        p = get_varint(p, end, count);
+        // Every block is at least a byte, and payloads have to have a kind each
+        if (p == nullptr || count / block_size > uint64_t(end - p) || ((kinds.size() != count) || ...)) {
+            return nullptr;
+        }
+        pool.resize(count);
+        std::vector<uint64_t> before(fields << 8);
+        for (size_t start = 0; start < count; start += block_size) {
+            uint64_t values[max_fields][block_size];
+            bool deltas[max_fields];
+            for (size_t field = 0; field < fields && p != nullptr; field++) {
+                p = get_block(p, end, values[field], deltas[field]);
+            }
+            if (p == nullptr) {
+                return nullptr;
+            }
+            for (size_t i = 0; i < std::min<size_t>(block_size, count - start); i++) {
+                size_t kind = kind_of(start + i, kinds...);
+                size_t field = 0;
+                visit_fields(pool[start + i], [&](auto& value) {
+                    using Field = std::decay_t<decltype(value)>;
+                    using Bits = decltype(field_bits(value));
+                    uint64_t& last = before[field << 8 | kind];
+                    uint64_t packed = values[field][i];
+                    Bits bits = deltas[field] ? Bits(last + (packed >> 1 ^ -(packed & 1))) : Bits(packed);
+                    last = bits;
+                    value = Field(bits);
+                    field++;
+                });
+            }
+        }
+        return p;
+    }
+
+    // The names and then every pool. The checksum says this is a file we wrote, but reading it still never goes past end
+    static inline bool read_body(const char* p, const char* end, uint64_t names, NodeProg& prog, Interner& interner) {
+        if (names > uint64_t(end - p)) {
+            return false;
+        }
+        std::vector<uint64_t> lengths(names);
+        for (uint64_t& length : lengths) {
+            p = get_varint(p, end, length);
+            if (p == nullptr) {
+                return false;
+            }
+        }
+        for (uint64_t length : lengths) {
+            // A name we already have would get the id of the first one, leaving every id after it one off
+            SymbolId id = interner.size();
+            if (length > uint64_t(end - p) || interner.intern({p, length}) != id) {
+                return false;
+            }
+            p += length;
+        }
+        bool ok = true;
+        visit_pools(prog, [&](auto& pool, const auto&... kinds) {
+            if (ok) {
+                p = get_pool(p, end, pool, kinds...);
+                ok = p != nullptr;
+            }
+        });
+        return ok && p == end && check_tree(prog, interner.size());
+    }
+
+    /*
+     * Whether prog is a tree Generator can walk. Every id has to point inside its pool, every kind and operator has to
+     * be one we have, and the walk Generator does (statements through stmt_next and scopes, predicates through their
+     * chains, expressions through their sides) must not reach anything twice. That last part is what makes it a tree:
+     * without it a file could send the walk around in circles, or share subtrees until generating them took forever.
+     * Anything the walk never reaches doesn't matter.
+     * The checksum means a file we didn't write only gets this far if it was made to, this is for when one was.
+     */
+    static inline bool check_tree(const NodeProg& prog, size_t names) {
+        const ExprPools& exprs = prog.exprs;
+        const StmtId stmts = prog.stmt_count();
+        if (prog.stmt_next.size() != stmts || exprs.expr_types.size() != exprs.expr_kinds.size()) {
+            return false;
+        }
+        auto number = [](TokenType type) {
+            return type == TokenType::int_lit || type == TokenType::float_lit;
+        };
+        std::vector<bool> seen_stmts(stmts);
+        std::vector<bool> seen_scopes(prog.scopes.size());
+        std::vector<bool> seen_preds(prog.pred_kinds.size());
+        std::vector<bool> seen_exprs(exprs.expr_kinds.size());
+        // True the first time id gets reached, false if it's out of range or was reached before
+        auto reach = [](std::vector<bool>& seen, uint32_t id) {
+            if (id >= seen.size() || seen[id]) {
+                return false;
+            }
+            seen[id] = true;
+            return true;
+        };
+
+        // Statements from first up to end, and expressions, still to be walked. The order doesn't matter, only that
+        // everything Generator will reach gets reached once
+        std::vector<NodeScope> runs {{0, stmts}};
+        std::vector<ExprId> roots;
+        auto scope = [&](ScopeId scope) {
+            if (!reach(seen_scopes, scope)) {
+                return false;
+            }
+            runs.push_back(prog.scopes[scope]);
+            return true;
+        };
+        // The chain of predicates after an if, one that links back to an earlier one gets reached twice
+        auto preds = [&](IfPredId pred) {
+            for (; pred != no_node; pred = prog.elifs[prog.pred_payloads[pred]].pred) {
+                if (!reach(seen_preds, pred)) {
+                    return false;
+                }
+                uint32_t payload = prog.pred_payloads[pred];
+                if (prog.pred_kinds[pred] == IfPredKind::else_) {
+                    return scope(payload);
+                }
+                if (prog.pred_kinds[pred] != IfPredKind::elif || payload >= prog.elifs.size()
+                    || !scope(prog.elifs[payload].scope)) {
+                    return false;
+                }
+                roots.push_back(prog.elifs[payload].expr);
+            }
+            return true;
+        };
+        while (!runs.empty()) {
+            NodeScope run = runs.back();
+            runs.pop_back();
+            for (StmtId stmt = run.first; stmt < run.end; stmt = prog.stmt_next[stmt]) {
+                if (!reach(seen_stmts, stmt)) {
+                    return false;
+                }
+                uint32_t payload = prog.stmt_payloads[stmt];
+                switch (prog.stmt_kinds[stmt]) {
+                    case StmtKind::exit:
+                        roots.push_back(payload);
+                        break;
+                    case StmtKind::let:
+                        if (payload >= prog.lets.size() || prog.lets[payload].ident >= names
+                            || !number(prog.lets[payload].int_or_float)) {
+                            return false;
+                        }
+                        roots.push_back(prog.lets[payload].expr);
+                        break;
+                    case StmtKind::assign:
+                        if (payload >= prog.assigns.size() || prog.assigns[payload].ident >= names) {
+                            return false;
+                        }
+                        roots.push_back(prog.assigns[payload].expr);
+                        break;
+                    case StmtKind::scope:
+                        if (!scope(payload)) {
+                            return false;
+                        }
+                        break;
+                    case StmtKind::if_:
+                        if (payload >= prog.ifs.size() || !scope(prog.ifs[payload].scope) || !preds(prog.ifs[payload].pred)) {
+                            return false;
+                        }
+                        roots.push_back(prog.ifs[payload].expr);
+                        break;
+                    default:
+                        return false;
+                }
+            }
+        }
+
+        while (!roots.empty()) {
+            ExprId expr = roots.back();
+            roots.pop_back();
+            if (!reach(seen_exprs, expr) || !number(exprs.expr_types[expr])) {
+                return false;
+            }
+            uint32_t payload = exprs.expr_payloads[expr];
+            if (exprs.expr_kinds[expr] == ExprKind::bin_expr) {
+                if (payload >= exprs.bins.size()) {
+                    return false;
+                }
+                const NodeBinExpr& bin = exprs.bins[payload];
+                if (bin.op > BinOp::div || !number(bin.int_or_float)) {
+                    return false;
+                }
+                roots.push_back(bin.lhs);
+                roots.push_back(bin.rhs);
+                continue;
+            }
+            if (exprs.expr_kinds[expr] != ExprKind::term || payload >= exprs.term_kinds.size()) {
+                return false;
+            }
+            uint32_t term = exprs.term_payloads[payload];
+            switch (exprs.term_kinds[payload]) {
+                case TermKind::int_lit:
+                    if (term >= exprs.int_lits.size()) {
+                        return false;
+                    }
+                    break;
+                case TermKind::float_lit:
+                    break;
+                case TermKind::ident:
+                    if (term >= names) {
+                        return false;
+                    }
+                    break;
+                case TermKind::paran:
+                    roots.push_back(term);
+                    break;
+                default:
+                    return false;
+            }
+        }
+        return true;
+    }
+
+    static inline bool write_all(int fd, const void* data, size_t size) {
+        const char* p = static_cast<const char*>(data);
+        while (size > 0) {
+            ssize_t n = write(fd, p, size);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                return false;
+            }
+            p += n;
+            size -= n;
+        }
+        return true;
+    }
+
+    inline void unmap() {
+        if (m_mapping != nullptr) {
+            munmap(m_mapping, m_size);
+            m_mapping = nullptr;
+            m_size = 0;
+        }
+    }
+
+    void* m_mapping = nullptr;
+    size_t m_size = 0;
+};
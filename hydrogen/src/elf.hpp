@@ -0,0 +1,202 @@
+// File for wrapping machine code up in ELF files the linker and linux understand
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <elf.h>
+
+template <class T>
+inline void elf_append(std::string& out, const T& value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+inline void elf_align(std::string& out, size_t alignment) {
+    out.resize((out.size() + alignment - 1) / alignment * alignment);
+}
+
+// Adds name to a string table, handing back where it starts
+inline uint32_t elf_add_name(std::string& table, const char* name) {
+    uint32_t offset = table.size();
+    table.append(name);
+    table.push_back('\0');
+    return offset;
+}
+
+// The parts of the file header that are the same for anything we write
+inline Elf64_Ehdr elf_header(uint16_t type) {
+    Elf64_Ehdr header {};
+    memcpy(header.e_ident, ELFMAG, SELFMAG);
+    header.e_ident[EI_CLASS] = ELFCLASS64;
+    header.e_ident[EI_DATA] = ELFDATA2LSB;
+    header.e_ident[EI_VERSION] = EV_CURRENT;
+    header.e_ident[EI_OSABI] = ELFOSABI_SYSV;
+    header.e_type = type;
+    header.e_machine = EM_X86_64;
+    header.e_version = EV_CURRENT;
+    header.e_ehsize = sizeof(Elf64_Ehdr);
+    header.e_shentsize = sizeof(Elf64_Shdr);
+    return header;
+}
+
+/*
+ * A relocatable object (what nasm -felf64 gives you) holding code as its .text, with a global _start at the front of
+ * it. Our code only ever jumps within itself, and Assembler already filled in every jump, so there is nothing to
+ * relocate. Besides .text there are just the tables ld needs to find _start, and an empty .note.GNU-stack, which tells
+ * ld we don't need an executable stack.
+ */
+inline std::string elf_object(const std::vector<uint8_t>& code) {
+    enum Section : uint16_t {
+        null_section,
+        text,
+        note_stack,
+        symtab,
+        strtab,
+        shstrtab,
+        section_count,
+    };
+
+    std::string names(1, '\0');
+    Elf64_Shdr sections[section_count] {};
+    sections[text].sh_name = elf_add_name(names, ".text");
+    sections[note_stack].sh_name = elf_add_name(names, ".note.GNU-stack");
+    sections[symtab].sh_name = elf_add_name(names, ".symtab");
+    sections[strtab].sh_name = elf_add_name(names, ".strtab");
+    sections[shstrtab].sh_name = elf_add_name(names, ".shstrtab");
+
+    std::string symbol_names(1, '\0');
+    Elf64_Sym symbols[3] {};
+    // The section symbol, every object has one for each section its symbols are in
+    symbols[1].st_info = ELF64_ST_INFO(STB_LOCAL, STT_SECTION);
+    symbols[1].st_shndx = text;
+    symbols[2].st_name = elf_add_name(symbol_names, "_start");
+    symbols[2].st_info = ELF64_ST_INFO(STB_GLOBAL, STT_NOTYPE);
+    symbols[2].st_shndx = text;
+
+    std::string out(sizeof(Elf64_Ehdr), '\0');
+
+    elf_align(out, 16);
+    sections[text].sh_type = SHT_PROGBITS;
+    sections[text].sh_flags = SHF_ALLOC | SHF_EXECINSTR;
+    sections[text].sh_offset = out.size();
+    sections[text].sh_size = code.size();
+    sections[text].sh_addralign = 16;
+    out.append(reinterpret_cast<const char*>(code.data()), code.size());
+
+    sections[note_stack].sh_type = SHT_PROGBITS;
+    sections[note_stack].sh_offset = out.size();
+    sections[note_stack].sh_addralign = 1;
+
+    elf_align(out, 8);
+    sections[symtab].sh_type = SHT_SYMTAB;
+    sections[symtab].sh_offset = out.size();
+    sections[symtab].sh_size = sizeof(symbols);
+    sections[symtab].sh_link = strtab;
+    // Index of the first global symbol, everything before it is local
+    sections[symtab].sh_info = 2;
+    sections[symtab].sh_addralign = 8;
+    sections[symtab].sh_entsize = sizeof(Elf64_Sym);
+    for (const Elf64_Sym& symbol : symbols) {
+        elf_append(out, symbol);
+    }
+
+    sections[strtab].sh_type = SHT_STRTAB;
+    sections[strtab].sh_offset = out.size();
+    sections[strtab].sh_size = symbol_names.size();
+    sections[strtab].sh_addralign = 1;
+    out += symbol_names;
+
+    sections[shstrtab].sh_type = SHT_STRTAB;
+    sections[shstrtab].sh_offset = out.size();
+    sections[shstrtab].sh_size = names.size();
+    sections[shstrtab].sh_addralign = 1;
+    out += names;
+
+    elf_align(out, 8);
+    Elf64_Ehdr header = elf_header(ET_REL);
+    header.e_shoff = out.size();
+    header.e_shnum = section_count;
+    header.e_shstrndx = shstrtab;
+    for (const Elf64_Shdr& section : sections) {
+        elf_append(out, section);
+    }
+    memcpy(out.data(), &header, sizeof(header));
+    return out;
+}
+
+// Where executables get loaded, same as ld's default for a non PIE program
+inline constexpr uint64_t elf_base = 0x400000;
+
+/*
+ * A static executable that runs code, what ld used to make out of elf_object's output. The kernel only looks at the
+ * program headers: one segment maps the start of the file (headers and code) read + execute at elf_base, the same place
+ * ld puts it, and PT_GNU_STACK asks for a stack that isn't executable. The code only ever refers to itself and the
+ * stack, so there is nothing else to load. The section headers after the code are just for objdump, gdb and friends.
+ */
+inline std::string elf_executable(const std::vector<uint8_t>& code) {
+    enum Segment {
+        load,
+        stack,
+        segment_count,
+    };
+    enum Section : uint16_t {
+        null_section,
+        text,
+        shstrtab,
+        section_count,
+    };
+
+    std::string names(1, '\0');
+    Elf64_Shdr sections[section_count] {};
+    sections[text].sh_name = elf_add_name(names, ".text");
+    sections[shstrtab].sh_name = elf_add_name(names, ".shstrtab");
+
+    std::string out(sizeof(Elf64_Ehdr) + segment_count * sizeof(Elf64_Phdr), '\0');
+
+    elf_align(out, 16);
+    uint64_t entry = elf_base + out.size();
+    sections[text].sh_type = SHT_PROGBITS;
+    sections[text].sh_flags = SHF_ALLOC | SHF_EXECINSTR;
+    sections[text].sh_addr = entry;
+    sections[text].sh_offset = out.size();
+    sections[text].sh_size = code.size();
+    sections[text].sh_addralign = 16;
+    out.append(reinterpret_cast<const char*>(code.data()), code.size());
+
+    Elf64_Phdr segments[segment_count] {};
+    segments[load].p_type = PT_LOAD;
+    segments[load].p_flags = PF_R | PF_X;
+    segments[load].p_vaddr = elf_base;
+    segments[load].p_paddr = elf_base;
+    segments[load].p_filesz = out.size();
+    segments[load].p_memsz = out.size();
+    segments[load].p_align = 0x1000;
+    segments[stack].p_type = PT_GNU_STACK;
+    segments[stack].p_flags = PF_R | PF_W;
+    segments[stack].p_align = 16;
+
+    sections[shstrtab].sh_type = SHT_STRTAB;
+    sections[shstrtab].sh_offset = out.size();
+    sections[shstrtab].sh_size = names.size();
+    sections[shstrtab].sh_addralign = 1;
+    out += names;
+
+    elf_align(out, 8);
+    Elf64_Ehdr header = elf_header(ET_EXEC);
+    header.e_entry = entry;
+    header.e_phoff = sizeof(Elf64_Ehdr);
+    header.e_phentsize = sizeof(Elf64_Phdr);
+    header.e_phnum = segment_count;
+    header.e_shoff = out.size();
+    header.e_shnum = section_count;
+    header.e_shstrndx = shstrtab;
+    for (const Elf64_Shdr& section : sections) {
+        elf_append(out, section);
+    }
+    memcpy(out.data(), &header, sizeof(header));
+    memcpy(out.data() + header.e_phoff, segments, sizeof(segments));
+    return out;
+}
@@ -0,0 +1,198 @@
+// File for the buffer the generator writes assembly into
+
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include <sys/uio.h>
+
+#include "error.hpp"
+
+// Uppercase hex of value, padded with zeros out to digits wide, for immediates
+struct Hex {
+    uint64_t value;
+    int digits;
+};
+
+/*
+ * Where the generator's assembly goes, in place of a stringstream. Text gets copied into fixed size chunks and numbers
+ * are formatted straight into them with to_chars, so writing an instruction never allocates or builds a temporary
+ * string. Nothing is ever taken back out, it only gets appended to.
+ *
+ * With an fd, once flush_chunks chunks are full they all go out in one writev and get filled again from the start, so
+ * however big the program is we never hold more than flush_chunks * chunk_size of it. Without one the chunks just
+ * pile up until finish() glues them into the string we hand back.
+ */
+class AsmBuffer {
+public:
+    static constexpr size_t chunk_size = 64 * 1024;
+    static constexpr size_t flush_chunks = 16;
+
+    inline explicit AsmBuffer(int fd = -1)
+        : m_fd(fd)
+    {
+        m_chunks.push_back({std::make_unique<char[]>(chunk_size)});
+        start_chunk();
+    }
+
+    // Holds pointers into its own chunks
+    AsmBuffer(const AsmBuffer&) = delete;
+    AsmBuffer& operator=(const AsmBuffer&) = delete;
+
+    inline AsmBuffer& operator<<(std::string_view text) {
+        // An empty view can have a null data(), which memcpy mustn't get even for 0 bytes
+        if (text.empty()) {
+            return *this;
+        }
+        if (size_t(m_end - m_pos) < text.size()) {
+            return append_split(text);
+        }
+        memcpy(m_pos, text.data(), text.size());
+        m_pos += text.size();
+        return *this;
+    }
+
+    inline AsmBuffer& operator<<(char c) {
+        if (m_pos == m_end) {
+            next_chunk();
+        }
+        *m_pos++ = c;
+        return *this;
+    }
+
+    template <class Int, std::enable_if_t<std::is_integral_v<Int> && !std::is_same_v<Int, char>, int> = 0>
+    inline AsmBuffer& operator<<(Int value) {
+        // The longest 64 bit number is 20 digits and a sign
+        if (m_end - m_pos < 24) {
+            next_chunk();
+        }
+        m_pos = std::to_chars(m_pos, m_end, value).ptr;
+        return *this;
+    }
+
+    inline AsmBuffer& operator<<(Hex hex) {
+        static constexpr char hex_chars[] = "0123456789ABCDEF";
+        if (m_end - m_pos < hex.digits) {
+            next_chunk();
+        }
+        for (int i = hex.digits - 1; i >= 0; i--) {
+            m_pos[i] = hex_chars[hex.value & 0xF];
+            hex.value >>= 4;
+        }
+        m_pos += hex.digits;
+        return *this;
+    }
+
+    // Everything written so far. With an fd it has all been written out by the time this returns, and we hand back ""
+    inline std::string finish() {
+        if (m_fd >= 0) {
+            flush();
+            return {};
+        }
+        end_chunk();
+        size_t total = 0;
+        for (size_t i = 0; i <= m_current; i++) {
+            total += m_chunks[i].size;
+        }
+        std::string text;
+        text.reserve(total);
+        for (size_t i = 0; i <= m_current; i++) {
+            text.append(m_chunks[i].data.get(), m_chunks[i].size);
+        }
+        m_current = 0;
+        start_chunk();
+        return text;
+    }
+
+private:
+    struct Chunk {
+        std::unique_ptr<char[]> data;
+        // How much of it is used, only up to date for chunks we've moved past
+        size_t size = 0;
+    };
+
+    // Text that doesn't fit in what's left of this chunk carries on at the start of the next one
+    inline AsmBuffer& append_split(std::string_view text) {
+        while (!text.empty()) {
+            if (m_pos == m_end) {
+                next_chunk();
+            }
+            size_t n = std::min(text.size(), size_t(m_end - m_pos));
+            memcpy(m_pos, text.data(), n);
+            m_pos += n;
+            text.remove_prefix(n);
+        }
+        return *this;
+    }
+
+    inline void next_chunk() {
+        end_chunk();
+        m_current++;
+        if (m_fd >= 0 && m_current == flush_chunks) {
+            m_current--;
+            flush();
+            return;
+        }
+        if (m_current == m_chunks.size()) {
+            m_chunks.push_back({std::make_unique<char[]>(chunk_size)});
+        }
+        start_chunk();
+    }
+
+    inline void start_chunk() {
+        m_pos = m_chunks[m_current].data.get();
+        m_end = m_pos + chunk_size;
+    }
+
+    inline void end_chunk() {
+        m_chunks[m_current].size = m_pos - m_chunks[m_current].data.get();
+    }
+
+    // Write every chunk out and start over from the first one
+    inline void flush() {
+        end_chunk();
+        iovec iov[flush_chunks];
+        size_t count = 0;
+        for (size_t i = 0; i <= m_current; i++) {
+            iov[count++] = {.iov_base = m_chunks[i].data.get(), .iov_len = m_chunks[i].size};
+        }
+        iovec* next = iov;
+        while (count > 0) {
+            ssize_t n = writev(m_fd, next, count);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0) {
+                throw CompileError("Could not write the assembly out: " + std::string(strerror(errno)));
+            }
+            // Step over whatever got written, a short write can stop partway through a chunk
+            while (count > 0 && size_t(n) >= next->iov_len) {
+                n -= next->iov_len;
+                next++;
+                count--;
+            }
+            if (count > 0) {
+                next->iov_base = static_cast<char*>(next->iov_base) + n;
+                next->iov_len -= n;
+            }
+        }
+        m_current = 0;
+        start_chunk();
+    }
+
+    int m_fd;
+    std::vector<Chunk> m_chunks;
+    size_t m_current = 0;
+    // Where the next byte goes in the current chunk, and its end
+    char* m_pos = nullptr;
+    char* m_end = nullptr;
+};
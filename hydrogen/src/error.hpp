@@ -0,0 +1,28 @@
+// File for the errors the compiler reports about the program it is compiling
+
+#pragma once
+
+#include <stdexcept>
+#include <string>
+
+#include "source.hpp"
+
+/*
+ * Anything that finds a mistake in the program throws one of these instead of printing and exiting, so the compiler
+ * can run inside somebody else's process. message is the whole line we show the user, location points at the
+ * mistake, or is 0, 0 when the error isn't about one spot (like an undeclared identifier).
+ * hydro::Compiler catches them and hands them back as diagnostics.
+ */
+struct CompileError : std::runtime_error {
+    inline explicit CompileError(const std::string& message, SourceLocation location = {0, 0})
+        : std::runtime_error(message),
+          location(location)
+    {}
+
+    SourceLocation location;
+};
+
+// "msg on line L, column C", how every error about a spot in the source reads
+inline std::string at_location(const std::string& msg, SourceLocation location) {
+    return msg + " on line " + std::to_string(location.line) + ", column " + std::to_string(location.column);
+}
@@ -2,345 +2,258 @@
 #pragma once
 
 #include "parser.hpp"
+#include "x86.hpp"
 #include <cassert>
 #include <algorithm>
-#include <iomanip>
-#include <sstream>
-#include <bitset>
 #include <optional>
 
 class Generator {
     public:
-        inline explicit Generator(NodeProg* prog)
-            : m_prog(std::move(prog))
+        // interner is where the identifier ids in the tree came from, we only need it for error messages
+        // Every instruction goes through output, which makes text and/or machine code out of it
+        inline explicit Generator(const NodeProg* prog, const Interner& interner, Assembler& output)
+            : m_prog(prog),
+              m_exprs(prog->exprs),
+              m_interner(interner),
+              m_output(output),
+              m_var_of(interner.size(), no_var)
         {}
 
-        void gen_term(const NodeTerm* term) {
-            struct TermVisitor {
-                // Changed gen from pointer to reference because refs cannot be null, ptrs can, this gives us good null checking
-                Generator& gen;
-
+        void gen_term(TermId term) {
+            uint32_t payload = m_exprs.term_payloads[term];
+            switch (m_exprs.term_kinds[term]) {
                 // This triggers anytime we need to use the value of an identifier
-                void operator()(const NodeTermIdent* term_ident) const {
-                    const auto it = std::find_if(
-                            gen.m_vars.cbegin(),
-                            gen.m_vars.cend(),
-                            [&](const Var& var) { return var.name == term_ident->ident.value.value();
-                            });
-                    if (it == gen.m_vars.cend()) {
-                        std::cerr << "Undeclared identifier: " << term_ident->ident.value.value() << std::endl;
-                        exit(EXIT_FAILURE);
+                case TermKind::ident: {
+                    const Var* var = find_var(payload);
+                    if (var == nullptr) {
+                        throw CompileError("Undeclared identifier: " + std::string(m_interner.name(payload)));
                     }
-                    std::stringstream offset;
-
                     // Taking value from further down in stack @ stack_loc and then making a copy of it and pushing it to top of stack so that it can be used
-                    offset << "QWORD [rsp + " << (gen.m_stack_size - it->stack_loc - 1) * 8 << "]";
-                    gen.push(offset.str());
+                    m_output.push_slot((m_stack_size - var->stack_loc - 1) * 8);
+                    m_stack_size++;
+                    break;
                 }
                 // Move value into register, push from register to stack
-                void operator()(const NodeTermIntLit* term_int_lit) const {
-                    gen.m_output << "    mov rax, " << term_int_lit->int_lit.value.value() << "\n";
-                    gen.push("rax");
-                }
+                case TermKind::int_lit:
+                    m_output.mov(Reg::rax, m_exprs.int_lits[payload]);
+                    push(Reg::rax);
+                    break;
                 // Move value into sse reg, then to stack
-                void operator()(const NodeTermFloatLit* term_float_lit) const {
-                    // Need to convert float to hex to use the proper instruction
-                    std::string hexFloat = gen.floatStringToHex(term_float_lit->float_lit.value.value());
-                    gen.m_output << "    mov rcx, 0x" << hexFloat << "\n";
-                    gen.m_output << "    movq xmm0, rcx" << "\n";
-                    gen.push_float("xmm0");
-                }
-
-                void operator()(const NodeTermParan* paran) const {
-                    gen.gen_expr(paran->expr);
-                }
-            };
-
-            // Remember that "this" is a keyword that refers to the current object instance.
-            // "this" is a pointer to the current object, *this dereferences it and allows us to use it
-            // In this case "this" is Generator*
-            TermVisitor visitor({.gen = *this});
-            std::visit(visitor, term->var);
+                case TermKind::float_lit:
+                    // Need the float's bits as hex to use the proper instruction
+                    m_output.mov(Reg::rcx, Hex{payload, 8});
+                    m_output.movq(Xmm::xmm0, Reg::rcx);
+                    push_float(Xmm::xmm0);
+                    break;
+                // Whatever is inside just goes on gen_expr's stack to be done next
+                case TermKind::paran:
+                    m_expr_stack.push_back({.expr = payload});
+                    break;
+            }
         }
 
-        void gen_bin_expr(const NodeBinExpr* bin_expr) {
-            struct BinExprVisitor {
-                Generator& gen;
-                void operator()(const NodeBinExprAdd* add) const {
-                    gen.m_output << "    ;; / begin addition\n";
-
-                    // Assembly for adding is to load values into 2 diff regs, then add
-                    gen.gen_expr(add->rhs);
-                    gen.gen_expr(add->lhs);
-
-                    if (add->lhs->int_or_float == TokenType::float_lit || add->rhs->int_or_float == TokenType::float_lit) {
-                        gen.pop_float("xmm0");
-                        gen.pop_float("xmm1");
-                        gen.m_output << "    addss xmm0, xmm1\n";
-                        gen.push_float("xmm0");
-                    } else {
-                        //To add, pop off top of stack into registers, doesnt matter which way we do, add is commutative
-                        gen.pop("rax");
-                        gen.pop("rbx");
-                        gen.m_output << "    add rax, rbx\n";
-                        std::cout << "OM JEERE";
-
-                        // put result back on stack, i think rax gets overwritten with new val
-                        gen.push("rax");
-                    }
-
-                    gen.m_output << "    ;; / end addition\n";
-                }
-
-                // Similarly done for multiplciation
-                void operator()(const NodeBinExprMulti* mult) const {
-                    gen.m_output << "    ;; / begin multiplication\n";
-                    gen.gen_expr(mult->rhs);
-                    gen.gen_expr(mult->lhs);
-                    if (mult->lhs->int_or_float == TokenType::float_lit || mult->rhs->int_or_float == TokenType::float_lit) {
-                        gen.pop_float("xmm0");
-                        gen.pop_float("xmm1");
-                        gen.m_output << "    mulss xmm0, xmm1\n";
-                        gen.push_float("xmm0");
-
-                    } else {
-                        gen.pop("rax");
-                        gen.pop("rbx");
-                        gen.m_output << "    mul rbx\n";
-                        std::cout << "OM JEERE";
-
-                        gen.push("rax");
-                    }
-
-                    gen.m_output << "    ;; / end multiplication\n";
-                }
-
-                void operator()(const NodeBinExprSub* sub) const {
-                    gen.m_output << "    ;; / begin subtraction\n";
-                    gen.gen_expr(sub->rhs);
-                    gen.gen_expr(sub->lhs);
-
-                    if (sub->lhs->int_or_float == TokenType::float_lit || sub->rhs->int_or_float == TokenType::float_lit) {
-                        gen.pop_float("xmm0");
-
-                        gen.pop_float("xmm1");
-                        gen.m_output << "    subss xmm0, xmm1\n";
-                        gen.push_float("xmm0");
-
-                    } else {
-                        gen.pop("rax");
-                        gen.pop("rbx");
-                        std::cout << "OM JEERE";
-                        gen.m_output << "    sub rax, rbx\n";
-                        gen.push("rax");
-                    }
-
-                    gen.m_output << "    ;; / end subtraction\n";
-                }
-
-                void operator()(const NodeBinExprDiv* div) const {
-                    gen.m_output << "    ;; / begin division\n";
-                    gen.gen_expr(div->rhs);
-                    gen.gen_expr(div->lhs);
-
-                    if (div->lhs->int_or_float == TokenType::float_lit || div->rhs->int_or_float == TokenType::float_lit) {
-
-                        gen.pop_float("xmm0");
-                        gen.pop_float("xmm1");
-                        gen.m_output << "    divss xmm0, xmm1\n";
-                        gen.push_float("xmm0");
-
-                    } else {
-                        std::cout << "OM JEERE";
-
-                        gen.pop("rax");
-                        gen.pop("rbx");
-                        gen.m_output << "    div rbx\n";
-
-                        gen.push("rax");
-                    }
-
-                    gen.m_output << "    ;; / end division\n";
-
+        // Once both sides of a binary expression are on the stack, this does the operator
+        void gen_bin_expr(BinExprId bin_expr) {
+            const NodeBinExpr& bin = m_exprs.bins[bin_expr];
+            const BinOpAsm& op = bin_op_asm(bin.op);
+
+            if (bin.int_or_float == TokenType::float_lit) {
+                pop_float(Xmm::xmm0);
+                pop_float(Xmm::xmm1);
+                m_output.sse(op.float_op, Xmm::xmm0, Xmm::xmm1);
+                push_float(Xmm::xmm0);
+            } else {
+                // Pop off top of stack into registers, lhs in rax and rhs in rbx
+                pop(Reg::rax);
+                pop(Reg::rbx);
+                switch (bin.op) {
+                    case BinOp::add:
+                        m_output.add(Reg::rax, Reg::rbx);
+                        break;
+                    case BinOp::multi:
+                        m_output.mul(Reg::rbx);
+                        break;
+                    case BinOp::sub:
+                        m_output.sub(Reg::rax, Reg::rbx);
+                        break;
+                    case BinOp::div:
+                        m_output.div(Reg::rbx);
+                        break;
                 }
-            };
+                // put result back on stack, i think rax gets overwritten with new val
+                push(Reg::rax);
+            }
 
-            BinExprVisitor visitor{.gen = *this};
-            std::visit(visitor, bin_expr->var);
+            m_output.comment("/ end ", op.name);
         }
 
-        void gen_scope(const NodeScope* scope) {
+        void gen_scope(ScopeId scope) {
             begin_scope();
             // Parse the list of statements specific to this scope and generate their code
-            for (const NodeStmt* stmt: scope->stmts) {
+            const NodeScope& stmts = m_prog->scopes[scope];
+            for (StmtId stmt = stmts.first; stmt < stmts.end; stmt = m_prog->stmt_next[stmt]) {
                 gen_stmt(stmt);
             }
             end_scope();
         }
 
-        void gen_expr(const NodeExpr* expr)  {
-            struct ExprVisitor {
-                Generator& gen;
-                void operator()(const NodeTerm* term) const {
-                    gen.gen_term(term);
+        /*
+         * Walks the expression with our own stack instead of recursing, so no amount of nesting can run us out of
+         * native stack. A binary expression goes on the stack twice: the first time it comes off we start it and put
+         * its sides on, the second time (with both sides done) gen_bin_expr does the operator.
+         */
+        void gen_expr(ExprId expr)  {
+            m_expr_stack.push_back({.expr = expr});
+            while (!m_expr_stack.empty()) {
+                PendingExpr pending = m_expr_stack.back();
+                m_expr_stack.pop_back();
+                uint32_t payload = m_exprs.expr_payloads[pending.expr];
+                if (m_exprs.expr_kinds[pending.expr] == ExprKind::term) {
+                    gen_term(payload);
+                } else if (pending.sides_done) {
+                    gen_bin_expr(payload);
+                } else {
+                    const NodeBinExpr& bin = m_exprs.bins[payload];
+                    m_output.comment("/ begin ", bin_op_asm(bin.op).name);
+                    // Assembly for an operator is to load values into 2 diff regs, then do it. rhs gets pushed first so
+                    // lhs ends up on top, and last on our stack comes off first, so lhs goes on before rhs
+                    m_expr_stack.push_back({.expr = pending.expr, .sides_done = true});
+                    m_expr_stack.push_back({.expr = bin.lhs});
+                    m_expr_stack.push_back({.expr = bin.rhs});
                 }
-                void operator()(const NodeBinExpr* expr_bin) const {
-                   gen.gen_bin_expr(expr_bin);
-                }
-            };
-
-            ExprVisitor visitor{.gen = *this};
-            std::visit(visitor, expr->var);
+            }
         }
 
-        void gen_if_pred(const NodeIfPred* pred, const std::string& end_label) {
-
-            struct PredVisitor {
-                Generator& gen;
-                const std::string& end_label_store;
-                void operator ()(const NodeIfPredElif* pred_elif) {
-                    gen.m_output << "    ;; / begin elif\n";
-                    gen.gen_expr(pred_elif->expr);
-
-                    gen.pop("rax");
-
-                    std::string label = gen.create_label();
-
-                    gen.m_output << "    test rax, rax\n";
-                    gen.m_output << "    jz " << label << "\n";
-                    gen.gen_scope(pred_elif->scope);
-                    // As soon as one of the elifs resolves, then dont check anything else and jump to endif
-                    gen.m_output << "    jmp " << end_label_store << '\n';
-                    // This is an elif, so we can have infinite elifs. Need to check if has value
-                    if (pred_elif->pred.has_value()) {
-                        gen.m_output << label << ":\n";
-                        gen.gen_if_pred(pred_elif->pred.value(), end_label_store);
-                    }
-                    gen.m_output << "    ;; / end elif\n";
+        void gen_if_pred(IfPredId pred, Label end_label) {
+            if (m_prog->pred_kinds[pred] == IfPredKind::elif) {
+                const NodeIfPredElif& pred_elif = m_prog->elifs[m_prog->pred_payloads[pred]];
+                m_output.comment("/ begin elif");
+                gen_expr(pred_elif.expr);
+
+                pop(Reg::rax);
+
+                Label label = m_output.new_label();
+
+                m_output.test(Reg::rax, Reg::rax);
+                m_output.jz(label);
+                gen_scope(pred_elif.scope);
+                // As soon as one of the elifs resolves, then dont check anything else and jump to endif
+                m_output.jmp(end_label);
+                // If this was the last elif and there's no else, a false condition just lands at the end of the chain
+                m_output.bind(label);
+                // This is an elif, so we can have infinite elifs. Need to check if has value
+                if (pred_elif.pred != no_node) {
+                    gen_if_pred(pred_elif.pred, end_label);
                 }
-                void operator ()(const NodeIfPredElse* pred_else) {
-                    gen.m_output << "    ;; / begin else\n";
-                    gen.gen_scope(pred_else->scope);
-                    gen.m_output << "    ;; / end else\n";
-                }
-            };
-
-            PredVisitor visitor{.gen = *this, .end_label_store = end_label};
-            std::visit(visitor, pred->var);
+                m_output.comment("/ end elif");
+            } else {
+                m_output.comment("/ begin else");
+                gen_scope(m_prog->pred_payloads[pred]);
+                m_output.comment("/ end else");
+            }
         }
-        void gen_stmt(const NodeStmt* stmt)  {
+        void gen_stmt(StmtId stmt)  {
 
             /*
              * Typically we will have statement(expression), like exit(60). So we eval expression first in
              * gen_expr, then push that value onto top of stack in assembly, and now in this function
              * we pop it off top of stack and evaluate the statement with it
              */
-            struct StmtVisitor {
-                Generator& gen;
-                void operator ()(const NodeStmtExit* stmt_exit) {
-                    gen.gen_expr(stmt_exit->expr);
+            uint32_t payload = m_prog->stmt_payloads[stmt];
+            switch (m_prog->stmt_kinds[stmt]) {
+                case StmtKind::exit:
+                    gen_expr(payload);
 
                     // Move code 60 telling program to exit
-                    gen.m_output << "    mov rax, 60\n";
+                    m_output.mov(Reg::rax, 60);
 
                     // Pop expression eval from rdi and evaluate syscall
-                    gen.pop("rdi");
-                    gen.m_output << "    syscall\n";
-                }
-                void operator ()(const NodeStmtLet* stmt_let) {
-
-                    // Code to find if identifier already in vector of identifiers
-                    auto it = std::find_if(
-                            gen.m_vars.cbegin(),
-                            gen.m_vars.cend(),
-                            [&](const Var& var) { return var.name == stmt_let->ident.value.value();
-                            });
-                    if (it != gen.m_vars.cend()) {
+                    pop(Reg::rdi);
+                    m_output.syscall();
+                    break;
+                case StmtKind::let: {
+                    const NodeStmtLet& stmt_let = m_prog->lets[payload];
+
+                    // Code to find if identifier already in our symbol table
+                    if (find_var(stmt_let.ident) != nullptr) {
                         // If we already initialized a variable with same identifier name
                         // ex. trying to init let x = 7 and let x = 8 after is wrong
-                        std::cerr << "Identifier already initialized! " << stmt_let->ident.value.value() << std::endl;
-                        exit(EXIT_FAILURE);
+                        throw CompileError("Identifier already initialized! " + std::string(m_interner.name(stmt_let.ident)));
                     }
 
-                    // Insert into vector, optionally its int or float type
-                    gen.m_vars.push_back({.stack_loc = gen.m_stack_size, .name = stmt_let->ident.value.value(), .int_or_float = stmt_let->int_or_float});
+                    // Insert into symbol table, optionally its int or float type
+                    declare_var({.stack_loc = m_stack_size, .name = stmt_let.ident, .int_or_float = stmt_let.int_or_float});
 
                     // Evaluate expression, variable could potentially be let y = x, so we need to evaluate x or get it
                     // Now value of expression is at top of the stack
-                    gen.gen_expr(stmt_let->expr);
-                    gen.m_output <<"    ;; /let\n";
+                    gen_expr(stmt_let.expr);
+                    m_output.comment("/let");
+                    break;
                 }
-                void operator ()(const NodeStmtAssign* stmt_assign) {
-
-                    // ID should already be in vector, if not throw an error
-                    auto it = std::find_if(
-                            gen.m_vars.cbegin(),
-                            gen.m_vars.cend(),
-                            [&](const Var& var) { return var.name == stmt_assign->ident.value.value();
-                            });
-                    if (it != gen.m_vars.cend()) {
+                case StmtKind::assign: {
+                    const NodeStmtAssign& stmt_assign = m_prog->assigns[payload];
+
+                    // ID should already be in the symbol table, if not throw an error
+                    const Var* it = find_var(stmt_assign.ident);
+                    if (it != nullptr) {
                         // Recall this function generates assembly that puts result of this expr on top of stack
-                        gen.gen_expr(stmt_assign->expr);
+                        gen_expr(stmt_assign.expr);
                         // Pop off top of stack into rax (int) or xmm0 (float), then back into memory
                         if (it->int_or_float == TokenType::int_lit) {
-                            gen.pop("rax");
-                            gen.m_output << "    mov [rsp + " << (gen.m_stack_size - it->stack_loc - 1) * 8 << "], rax\n";
+                            pop(Reg::rax);
+                            m_output.store((m_stack_size - it->stack_loc - 1) * 8, Reg::rax);
                         } else if (it->int_or_float == TokenType::float_lit) {
-                            gen.pop_float("xmm0");
-                            gen.m_output << "    movq [rsp + " << (gen.m_stack_size - it->stack_loc - 1) * 8 << "], xmm0\n";
+                            pop_float(Xmm::xmm0);
+                            m_output.store((m_stack_size - it->stack_loc - 1) * 8, Xmm::xmm0);
                         }
                     } else {
-                        std::cerr << "Identifier not initialized: " << stmt_assign->ident.value.value() << std::endl;
-                        exit(EXIT_FAILURE);
+                        throw CompileError("Identifier not initialized: " + std::string(m_interner.name(stmt_assign.ident)));
                     }
-
+                    break;
                 }
-                void operator ()(const NodeScope* stmt_scope) {
-                        gen.gen_scope(stmt_scope);
-                }
-                void operator ()(const NodeStmtIf* stmt_if) {
+                case StmtKind::scope:
+                    gen_scope(payload);
+                    break;
+                case StmtKind::if_: {
+                    const NodeStmtIf& stmt_if = m_prog->ifs[payload];
                     // Puts result of expression on top of stack
-                    gen.gen_expr(stmt_if->expr);
+                    gen_expr(stmt_if.expr);
 
                     // Pop off the top into rax, result of expression in rax
-                    gen.pop("rax");
+                    pop(Reg::rax);
 
                     // No types, so no bools, so if result is anything other than 0 its true, aka jump to a label
-                    std::string label = gen.create_label();
+                    Label label = m_output.new_label();
 
                     // Generate assembly for jump statement
-                    gen.m_output << "    test rax, rax\n";
-                    gen.m_output << "    jz " << label << "\n";
-                    gen.gen_scope(stmt_if->scope);
-                    if (stmt_if->pred.has_value()) {
-                        std::string end_label = gen.create_label();
-                        gen.m_output << "    jmp " << end_label << "\n";
-                        gen.m_output << label << ":\n";
-                        gen.gen_if_pred(stmt_if->pred.value(), end_label);
+                    m_output.test(Reg::rax, Reg::rax);
+                    m_output.jz(label);
+                    gen_scope(stmt_if.scope);
+                    if (stmt_if.pred != no_node) {
+                        Label end_label = m_output.new_label();
+                        m_output.jmp(end_label);
+                        m_output.bind(label);
+                        gen_if_pred(stmt_if.pred, end_label);
                         // End label is the label that skips over everything once if elif else resolves
-                        gen.m_output << end_label<< ":\n";
+                        m_output.bind(end_label);
                     } else {
-                        gen.m_output << label << ":\n";
+                        m_output.bind(label);
                     }
-                    gen.m_output << "    ;; /if\n";
+                    m_output.comment("/if");
+                    break;
                 }
-            };
-            StmtVisitor visitor{.gen = *this};
-            std::visit(visitor, stmt->var);
+            }
         }
 
-        // Generate the program based on the abstract syntax tree its made up from
-        std::string gen_prog()  {
+        // Generate the program based on the abstract syntax tree its made up from, what comes out is in the Assembler
+        void gen_prog()  {
 
-            m_output << "global _start\n_start:\n";
-            for (const NodeStmt* stmt: m_prog->stmts) {
+            m_output.begin_program();
+            for (StmtId stmt = 0; stmt < m_prog->stmt_count(); stmt = m_prog->stmt_next[stmt]) {
                 gen_stmt(stmt);
             }
 
-            m_output << "    mov rax, 60\n";
-            m_output << "    mov rdi, 0\n";
-            m_output << "    syscall";
-            return m_output.str();
+            m_output.end_program();
         }
     private:
         void begin_scope() {
@@ -353,75 +266,104 @@ class Generator {
             // Move stack pointer in assembly back to where this scope began
             // Stack grows from top so we add not subtract when we want to remove these elements
             // Each object is 8 bytes, mult by 8
-            m_output << "    add rsp, " << pop_count * 8 << "\n";
+            m_output.add(Reg::rsp, pop_count * 8);
             m_stack_size -= pop_count;
 
-            // Remove variables associated with scope from m_vars
-            for (int i = 0; i < pop_count; i++) {
-                m_vars.pop_back();
+            // Remove variables associated with scope from m_vars, and from the symbol table. A let can't reuse a live
+            // name, so nothing outside this scope had these names
+            for (size_t i = m_scopes.back(); i < m_vars.size(); i++) {
+                m_var_of[m_vars[i].name] = no_var;
             }
+            m_vars.resize(m_scopes.back());
             m_scopes.pop_back();
         }
 
-        void push(const std::string& reg) {
-            m_output << "    push " << reg << "\n";
+        void push(Reg reg) {
+            m_output.push(reg);
             m_stack_size++;
         }
 
-        void pop(const std::string& reg) {
-            m_output << "    pop " << reg << "\n";
+        void pop(Reg reg) {
+            m_output.pop(reg);
             m_stack_size--;
         }
 
         // Since no actual push or pop command for sse registers, gonna have to do this manually
-        void push_float(const std::string& reg) {
-            m_output << "    sub rsp, 8" << "\n";
-            m_output << "    movq qword [rsp], "<< reg <<  "\n";
+        void push_float(Xmm reg) {
+            m_output.sub(Reg::rsp, 8);
+            m_output.store_top(reg);
             m_stack_size++;
         }
 
-        void pop_float(const std::string& reg) {
-            m_output << "    movq " << reg << ", QWORD [rsp]" << "\n";
-            m_output << "    add rsp, 8" << "\n";
+        void pop_float(Xmm reg) {
+            m_output.load_top(reg);
+            m_output.add(Reg::rsp, 8);
             m_stack_size--;
         }
 
-        // Function to convert float to hexadecimal
-        std::string floatStringToHex(const std::string& floatString) {
-            // Convert string to float
-            float floatValue = std::stof(floatString);
-
-            // Convert float to binary string
-            std::bitset<sizeof(float) * 8> bits(*reinterpret_cast<unsigned int*>(&floatValue));
-
-            // Convert binary string to hexadecimal string
-            std::stringstream hexStream;
-            hexStream << std::hex << std::uppercase << std::setw(sizeof(float) * 2) << std::setfill('0') << bits.to_ulong();
-            return hexStream.str();
-        }
+        // Floats are done the same way for every operator, only the instruction changes. Ints differ more than
+        // that, see gen_bin_expr
+        struct BinOpAsm {
+            const char* name;
+            SseOp float_op;
+        };
 
-        // Creates labels for assembly jumping for if statements
-        std::string create_label() {
-            return "label" + std::to_string(m_label_count++);
+        static const BinOpAsm& bin_op_asm(BinOp op) {
+            static constexpr BinOpAsm ops[] = {
+                    {"addition", SseOp::addss},
+                    {"multiplication", SseOp::mulss},
+                    {"subtraction", SseOp::subss},
+                    {"division", SseOp::divss},
+            };
+            return ops[size_t(op)];
         }
 
         const NodeProg* m_prog;
-        std::stringstream m_output;
+        const ExprPools& m_exprs;
+        const Interner& m_interner;
+        Assembler& m_output;
 
         // Our own stack pointer to keep track of what we are pushing and popping onto stack
         size_t m_stack_size = 0;
 
+        static constexpr uint32_t no_var = UINT32_MAX;
+
         struct  Var {
             size_t stack_loc;
-            std::string name;
+            SymbolId name;
             std::optional<TokenType> int_or_float;
         };
 
-        // vector to store object and its location on stack
+        // vector to store object and its location on stack, innermost scope last
         std::vector<Var> m_vars {};
 
+        /*
+         * Symbol table, for every name the index in m_vars of the live variable called that, or no_var.
+         * Names are SymbolIds, which the interner hands out as 0, 1, 2, ..., so an array indexed by them is a hash
+         * table that never collides: looking a name up, declaring one and popping one are all O(1) no matter how many
+         * variables are live. There is never more than one live variable per name, since a let of a name that is
+         * already live is an error, even in an inner scope.
+         */
+        std::vector<uint32_t> m_var_of;
+
+        // The live variable called name, nullptr if there isn't one
+        inline const Var* find_var(SymbolId name) const {
+            uint32_t index = m_var_of[name];
+            return index == no_var ? nullptr : &m_vars[index];
+        }
+
+        inline void declare_var(Var var) {
+            m_var_of[var.name] = m_vars.size();
+            m_vars.push_back(var);
+        }
+
         // Vector of indices into Vars
         std::vector<size_t> m_scopes {};
 
-        int m_label_count = 0;
+        // Expressions gen_expr still has to do, sides_done is set for a binary expression whose operator is all that's left
+        struct PendingExpr {
+            ExprId expr;
+            bool sides_done = false;
+        };
+        std::vector<PendingExpr> m_expr_stack;
 };
\ No newline at end of file
@@ -0,0 +1,90 @@
+// libhydro, see hydro.hpp
+
+#include "hydro.hpp"
+
+#include <optional>
+
+#include "cache.hpp"
+#include "elf.hpp"
+#include "generation.hpp"
+
+namespace hydro {
+
+// Everything a compile uses that's worth keeping around for the next one
+struct Compiler::Workspace {
+    Interner interner;
+    Parser parser;
+    // Where a tree read back out of the cache goes, the names in interner point into cache's mapping
+    AstCache cache;
+    NodeProg cached;
+};
+
+Compiler::Compiler()
+    : m_workspace(std::make_unique<Workspace>())
+{}
+
+Compiler::~Compiler() = default;
+
+Result Compiler::compile(std::string_view src, const Options& options) {
+    Result result;
+    Interner& interner = m_workspace->interner;
+    interner.clear();
+    try {
+        size_t threads = options.threads == 0 ? hardware_threads() : options.threads;
+
+        // With one thread the parser pulls tokens out of the tokenizer as it needs them, with more we tokenize
+        // everything up front across all of them and then parse that list on all of them too
+        // Every identifier gets interned here, and the rest of the compiler works with the ids it hands out
+        const NodeProg* prog;
+        Sha256Digest source {};
+        if (!options.cache_dir.empty()) {
+            source = sha256(src);
+            m_workspace->cached.clear();
+            bool hit = m_workspace->cache.load(options.cache_dir, source, m_workspace->cached, interner);
+            result.cache = hit ? CacheStatus::hit : CacheStatus::miss;
+        }
+        if (result.cache == CacheStatus::hit) {
+            prog = &m_workspace->cached;
+        } else if (threads > 1) {
+            TokenStore tokens = tokenize_parallel(src, threads, interner);
+            prog = &m_workspace->parser.parse_prog(tokens, threads);
+        } else {
+            Tokenizer tokenizer(src, interner);
+            prog = &m_workspace->parser.parse_prog(tokenizer);
+        }
+        // Only programs that parse get saved, a parse error has to be found again every time anyway
+        if (result.cache == CacheStatus::miss) {
+            m_workspace->cache.store(options.cache_dir, source, *prog, interner);
+        }
+
+        result.arena = {
+            .bytes_used = prog->arena.bytes_used(),
+            .high_water = prog->arena.high_water(),
+            .bytes_reserved = prog->arena.bytes_reserved(),
+        };
+
+        Assembler assembler(options.assembly, options.output_fd, options.object || options.executable);
+        Generator generator(prog, interner, assembler);
+        generator.gen_prog();
+        result.assembly = assembler.finish_text();
+        if (options.object || options.executable) {
+            std::vector<uint8_t> code = assembler.finish_code();
+            if (options.object) {
+                result.object = elf_object(code);
+            }
+            if (options.executable) {
+                result.executable = elf_executable(code);
+            }
+        }
+    } catch (const CompileError& error) {
+        result.diagnostics.push_back({.message = error.what(), .line = error.location.line, .column = error.location.column});
+    }
+    return result;
+}
+
+Result compile(std::string_view src, const Options& options) {
+    thread_local Compiler compiler;
+    return compiler.compile(src, options);
+}
+
+}
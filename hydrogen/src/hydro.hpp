@@ -0,0 +1,92 @@
+// File for libhydro, the compiler as a library. This is the only header someone embedding the compiler needs
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace hydro {
+
+struct Options {
+    // Threads to tokenize and parse on, 0 means one per core
+    size_t threads = 1;
+    // Directory to save parsed programs in, so compiling the same source again skips tokenizing and parsing.
+    // Empty means no cache
+    std::string cache_dir;
+    // What to make: nasm assembly text, an ELF64 object file, a static ELF64 executable (the last two straight from our
+    // own x86-64 encoder), in any combination
+    bool assembly = true;
+    bool object = false;
+    bool executable = false;
+    // If this is a file descriptor, the assembly gets written to it as it is generated, a bit at a time so memory use
+    // stays flat, instead of ending up in Result::assembly. After an error whatever got written is garbage
+    int output_fd = -1;
+};
+
+// What the AST cache did on a compile
+enum class CacheStatus {
+    off,
+    hit,
+    miss,
+};
+
+// How much memory the tree took out of its arena (see arena.hpp), in bytes
+struct ArenaStats {
+    size_t bytes_used = 0;
+    // Most that arena has ever held, across every compile that used it
+    size_t high_water = 0;
+    size_t bytes_reserved = 0;
+};
+
+// Something wrong with the program. line and column start at 1, and are 0 when it isn't about one spot in the source
+struct Diagnostic {
+    std::string message;
+    size_t line = 0;
+    size_t column = 0;
+};
+
+struct Result {
+    // x86-64 nasm assembly for the whole program, empty if there were errors, we weren't asked for it, or it went to
+    // Options::output_fd
+    std::string assembly;
+    // The bytes of a relocatable ELF64 object (a .o, ready for ld) if Options::object was set and there were no errors
+    std::string object;
+    // A whole static executable, already linked, if Options::executable was set and there were no errors. Write it out
+    // with execute permission and it runs
+    std::string executable;
+    std::vector<Diagnostic> diagnostics;
+    CacheStatus cache = CacheStatus::off;
+    ArenaStats arena;
+
+    inline bool ok() const {
+        return diagnostics.empty();
+    }
+};
+
+/*
+ * Compiles programs, holding onto the memory it used (the tree, the identifier table, ...) so the next compile doesn't
+ * have to allocate it all again. Never exits or throws over a bad program, every error comes back in the Result.
+ * One Compiler must not be used from two threads at once, but separate Compilers share nothing (other than files in a cache_dir, which is safe), so give each thread
+ * its own (or just call hydro::compile below).
+ */
+class Compiler {
+public:
+    Compiler();
+    ~Compiler();
+
+    Compiler(const Compiler&) = delete;
+    Compiler& operator=(const Compiler&) = delete;
+
+    Result compile(std::string_view src, const Options& options = {});
+
+private:
+    struct Workspace;
+    std::unique_ptr<Workspace> m_workspace;
+};
+
+// Compile with a Compiler that belongs to the calling thread, so calls on any number of threads are fine
+Result compile(std::string_view src, const Options& options = {});
+
+}
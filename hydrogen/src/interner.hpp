@@ -0,0 +1,94 @@
+// File for the identifier interner
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+// Every distinct identifier in a program gets one of these, so later phases compare ints instead of strings
+using SymbolId = uint32_t;
+
+/*
+ * Hands out a SymbolId for every distinct name it sees, handing the same name back the same id. One of these lives
+ * for the whole compilation: the tokenizer interns identifiers as it lexes them, and the parser and generator only
+ * ever see the ids. Names are views into whatever buffer they came from (normally the source), so that has to outlive
+ * the interner too.
+ *
+ * Lookups go through an open addressing table (linear probing) of ids, kept at most half full.
+ */
+class Interner {
+public:
+    inline Interner()
+    {
+        m_table.assign(64, empty);
+    }
+
+    inline SymbolId intern(std::string_view name) {
+        uint32_t hash = hash_name(name);
+        size_t mask = m_table.size() - 1;
+        for (size_t slot = hash & mask;; slot = (slot + 1) & mask) {
+            SymbolId id = m_table[slot];
+            if (id == empty) {
+                id = SymbolId(m_names.size());
+                m_names.push_back(name);
+                m_hashes.push_back(hash);
+                m_table[slot] = id;
+                if (m_names.size() * 2 > m_table.size()) {
+                    grow();
+                }
+                return id;
+            }
+            if (m_hashes[id] == hash && m_names[id] == name) {
+                return id;
+            }
+        }
+    }
+
+    inline std::string_view name(SymbolId id) const {
+        return m_names[id];
+    }
+
+    // Forget every name, but keep the table we have grown to for the next compile
+    inline void clear() {
+        std::fill(m_table.begin(), m_table.end(), empty);
+        m_names.clear();
+        m_hashes.clear();
+    }
+
+    // Number of distinct names, ids are always 0 ... size() - 1
+    inline size_t size() const {
+        return m_names.size();
+    }
+
+private:
+    static constexpr SymbolId empty = UINT32_MAX;
+
+    // FNV-1a, identifiers are short so this is plenty
+    static inline uint32_t hash_name(std::string_view name) {
+        uint32_t hash = 2166136261u;
+        for (char c : name) {
+            hash = (hash ^ uint8_t(c)) * 16777619u;
+        }
+        return hash;
+    }
+
+    // Double the table and put every id back, we kept the hashes so nothing gets rehashed
+    inline void grow() {
+        std::vector<SymbolId> table(m_table.size() * 2, empty);
+        size_t mask = table.size() - 1;
+        for (SymbolId id = 0; id < m_names.size(); id++) {
+            size_t slot = m_hashes[id] & mask;
+            while (table[slot] != empty) {
+                slot = (slot + 1) & mask;
+            }
+            table[slot] = id;
+        }
+        m_table = std::move(table);
+    }
+
+    std::vector<SymbolId> m_table;
+    std::vector<std::string_view> m_names;
+    std::vector<uint32_t> m_hashes;
+};
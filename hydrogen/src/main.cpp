@@ -1,56 +1,155 @@
+#include <cerrno>
+#include <charconv>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
-#include <fstream>
-#include <sstream>
-#include <optional>
-#include <vector>
 
-#include "./generation.hpp"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "./hydro.hpp"
+#include "./source.hpp"
+
+void print_usage() {
+    std::cerr << "Incorrect usage. Correct Usage is..." << std::endl;
+    std::cerr << "./hydro [-j <threads>] [-c <dir>] [-s] [-S] <input.hy>" << std::endl;
+    std::cerr << "./hydro [-j <threads>] [-c <dir>] [-s] [-S] - (reads source from stdin)" << std::endl;
+    std::cerr << "    -j <threads>  tokenize and parse on this many threads, 0 means one per core (default 1)" << std::endl;
+    std::cerr << "    -c <dir>      cache parsed programs in dir, so unchanged sources skip tokenizing and parsing" << std::endl;
+    std::cerr << "    -s            print stats (cache hits and misses, AST memory) to stderr" << std::endl;
+    std::cerr << "    -S            also write the assembly to out.asm, for reading" << std::endl;
+}
+
+// Replaces path with an executable file holding bytes. The old one gets unlinked first, like ld does, so we can still
+// write it while an earlier build of it is running
+bool write_executable(const char* path, std::string_view bytes) {
+    if (unlink(path) < 0 && errno != ENOENT) {
+        return false;
+    }
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0755);
+    if (fd < 0) {
+        return false;
+    }
+    while (!bytes.empty()) {
+        ssize_t n = write(fd, bytes.data(), bytes.size());
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            int error = errno;
+            close(fd);
+            errno = error;
+            return false;
+        }
+        bytes.remove_prefix(n);
+    }
+    return close(fd) == 0;
+}
 
 int main(int argc, char** argv) {
-    if (argc != 2) {
-        std::cerr << "Incorrect usage. Correct Usage is..." << std::endl;
-        std::cerr << "./hydro <input.hy>" << std::endl;
+    // Flags come first, then the file to compile
+    size_t jobs = 1;
+    std::string cache_dir;
+    bool stats = false;
+    bool write_asm = false;
+    int arg = 1;
+    while (arg < argc - 1) {
+        std::string_view flag = argv[arg];
+        if (flag == "-j") {
+            // Only a plain number, so a typo can't quietly turn into 0, which means every core
+            std::string_view threads = argv[arg + 1];
+            auto [end, error] = std::from_chars(threads.data(), threads.data() + threads.size(), jobs);
+            if (error != std::errc() || end != threads.data() + threads.size()) {
+                std::cerr << "-j needs a number of threads, got '" << threads << "'" << std::endl;
+                return EXIT_FAILURE;
+            }
+            arg += 2;
+        } else if (flag == "-c") {
+            cache_dir = argv[arg + 1];
+            arg += 2;
+        } else if (flag == "-s") {
+            stats = true;
+            arg++;
+        } else if (flag == "-S") {
+            write_asm = true;
+            arg++;
+        } else {
+            break;
+        }
+    }
+    if (arg != argc - 1) {
+        print_usage();
         return EXIT_FAILURE;
     }
 
     /*
      * Get File Contents before we start to tokenize the string
-     * Make a string to hold our text eventually
-     * Open a file with fstream, in input mode, the file is @ argv[1] (../test.hy for example)
-     * Input is full if this is successful, then we read its buffer into the contents stream,
-     * then we convert that content_stream into a string, and we have read our file into a string contents
+     * The input file (../test.hy for example) gets memory mapped, or read in if it is a pipe or "-" for stdin,
+     * and the tokenizer just gets a view of that memory. source has to stay alive until we are done compiling.
      */
-    std::string contents;
-    // Do it in own scope so fstream closes when out of scope
-    // Read in code as stream and convert to string we shall then convert to tokens
-    {
-        std::stringstream contents_stream;
-        std::fstream input(argv[1], std::ios::in);
-        contents_stream << input.rdbuf();
-        contents = contents_stream.str();
-    }
-
-    // Convert string of code to tokens to then be parsed
-    Tokenizer tokenizer(std::move(contents));
-    std::vector<Token> tokens = tokenizer.tokenize();
-    Parser parser(tokens);
-    std::optional<NodeProg*> prog = parser.parse_prog();
-
-    // Here if the parser returned no exit statement, then tree will be empty.
-    if (!prog.has_value()) {
-        std::cerr << "Invalid Program!" << std::endl;
-        exit(EXIT_FAILURE);
-    }
-    // Similarly, value is a member of the optional class and returns the value which we use to fill a file with the correct assembly
-    {
-        Generator generator(prog.value());
-        std::fstream file("out.asm", std::ios::out);
-        file << generator.gen_prog();
-    }
-
-    // Run assembler and linker
-    system("nasm -felf64 out.asm");
-    system("ld -o out out.o");
+    SourceFile source(argv[arg]);
+
+    // With -S the assembly gets written into a temporary file as it is generated, which only turns into out.asm once
+    // the whole program compiled, so a failed compile leaves any old out.asm alone
+    char asm_path[] = "out.asm.XXXXXX";
+    int asm_fd = -1;
+    if (write_asm) {
+        asm_fd = mkstemp(asm_path);
+        if (asm_fd < 0) {
+            std::cerr << "Could not create out.asm" << std::endl;
+            return EXIT_FAILURE;
+        }
+        // mkstemp makes it 0600, but out.asm should come out like any other file we write
+        if (fchmod(asm_fd, 0644) < 0) {
+            perror("Could not create out.asm");
+            close(asm_fd);
+            unlink(asm_path);
+            return EXIT_FAILURE;
+        }
+    }
+
+    // All the actual compiling is in libhydro, we just hand it the source and get a finished executable back
+    hydro::Result result = hydro::compile(source.view(), {
+        .threads = jobs,
+        .cache_dir = cache_dir,
+        .assembly = write_asm,
+        .executable = true,
+        .output_fd = asm_fd,
+    });
+    if (write_asm) {
+        close(asm_fd);
+    }
+    if (stats) {
+        const char* cache = "off";
+        if (result.cache == hydro::CacheStatus::hit) {
+            cache = "hit";
+        } else if (result.cache == hydro::CacheStatus::miss) {
+            cache = "miss";
+        }
+        std::cerr << "[Stats] AST cache: " << cache << std::endl;
+        std::cerr << "[Stats] AST arena: " << result.arena.bytes_used / 1024 << " KB used, " << result.arena.high_water / 1024
+                  << " KB high water, " << result.arena.bytes_reserved / 1024 << " KB reserved" << std::endl;
+    }
+    if (!result.ok()) {
+        if (write_asm) {
+            unlink(asm_path);
+        }
+        for (const hydro::Diagnostic& diagnostic : result.diagnostics) {
+            std::cerr << diagnostic.message << std::endl;
+        }
+        return EXIT_FAILURE;
+    }
+    if (write_asm && rename(asm_path, "out.asm") < 0) {
+        perror("Could not write out.asm");
+        unlink(asm_path);
+        return EXIT_FAILURE;
+    }
+    if (!write_executable("out", result.executable)) {
+        std::cerr << "Could not write out: " << strerror(errno) << std::endl;
+        return EXIT_FAILURE;
+    }
 
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,56 @@
+// File for splitting work across threads
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// How many threads "use every core" means on this machine, never less than 1
+inline size_t hardware_threads() {
+    return std::max<size_t>(1, std::thread::hardware_concurrency());
+}
+
+/*
+ * Run task(0) ... task(count - 1) spread over at most threads threads, and wait for all of them to finish.
+ * Threads grab the next index off a shared counter, so uneven tasks still balance out. The calling thread
+ * does work too, so threads == 1 is just a plain loop with no threads spawned at all.
+ * If tasks throw, the exception from the lowest index gets rethrown here once every thread is done, so we report
+ * the same error a plain loop would have hit first.
+ */
+template<typename Task>
+inline void parallel_for(size_t count, size_t threads, Task task) {
+    std::atomic<size_t> next = 0;
+    std::mutex failure_mutex;
+    size_t failed_index = SIZE_MAX;
+    std::exception_ptr failure;
+    auto worker = [&]() {
+        for (size_t i = next++; i < count; i = next++) {
+            try {
+                task(i);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(failure_mutex);
+                if (i < failed_index) {
+                    failed_index = i;
+                    failure = std::current_exception();
+                }
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (size_t t = 1; t < std::min(threads, count); t++) {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (std::thread& thread : workers) {
+        thread.join();
+    }
+    if (failure) {
+        std::rethrow_exception(failure);
+    }
+}
@@ -5,317 +5,514 @@
 
 #pragma once
 
-#include <variant>
+#include <memory>
+#include <vector>
 #include "arena.hpp"
 #include "tokenization.hpp"
 
-struct NodeTermIntLit {
-    Token int_lit;
+/*
+ * The tree is flat: every kind of node lives in its own array (a pool), and nodes point at each other with 32 bit
+ * indices into those arrays instead of pointers. The pools are ArenaArrays in the program's arena, so a whole tree is
+ * a handful of big blocks that all go away with one reset. Where a node can be one of several things (a statement can be an
+ * exit, a let, ...) the kind is a byte in one array and the payload is a 32 bit index in another, so looking at the
+ * kind doesn't drag the payload into cache and nothing needs a std::variant.
+ *
+ * Nodes are laid out in preorder, in the same order Generator visits them, so generating code walks every pool from
+ * front to back.
+ */
+
+// Indices into the pools below, one per kind of node
+using StmtId = uint32_t;
+using ExprId = uint32_t;
+using TermId = uint32_t;
+using BinExprId = uint32_t;
+using ScopeId = uint32_t;
+using IfPredId = uint32_t;
+
+// For children that are optional, like the elif/else after an if
+inline constexpr uint32_t no_node = UINT32_MAX;
+
+// Expressions are either a term or a binary expression, payload is a TermId or a BinExprId
+enum class ExprKind : uint8_t {
+    term,
+    bin_expr,
 };
 
-struct NodeTermFloatLit {
-    Token float_lit;
+// Payload is an index into int_lits, the bits of the single precision float, the identifier's SymbolId, or the ExprId
+// of whatever is inside the parantheses, like (10 + 1) / 11
+enum class TermKind : uint8_t {
+    int_lit,
+    float_lit,
+    ident,
+    paran,
 };
 
-// An identifier is like the x in "let x = 7"
-struct NodeTermIdent {
-     Token ident;
+enum class BinOp : uint8_t {
+    add,
+    multi,
+    sub,
+    div,
 };
 
-// Define here so C++ compiler knows our intent for BinExprAdd/Mult
-struct NodeExpr;
-
-struct NodeBinExprAdd{
-    NodeExpr* lhs;
-    NodeExpr* rhs;
+// Binary expressions let us add or multiply numbers in the correct order of operations. Everything about one is in
+// this node, int_or_float says whether the operation itself is done on floats, which it is if either side is a float.
+// That's not always the type of the expression it makes, see Parser::reduce
+struct NodeBinExpr {
+    ExprId lhs;
+    ExprId rhs;
+    BinOp op;
+    TokenType int_or_float;
 };
 
-struct NodeBinExprMulti{
-    NodeExpr* lhs;
-    NodeExpr* rhs;
-};
+// Every expression in the program, and the terms and binary expressions they are made of
+struct ExprPools {
+    inline explicit ExprPools(ArenaAllocator& arena)
+        : expr_kinds(arena),
+          expr_payloads(arena),
+          expr_types(arena),
+          term_kinds(arena),
+          term_payloads(arena),
+          int_lits(arena),
+          bins(arena)
+    {}
 
-struct NodeBinExprSub{
-    NodeExpr* lhs;
-    NodeExpr* rhs;
-};
+    ArenaArray<ExprKind> expr_kinds;
+    ArenaArray<uint32_t> expr_payloads;
+    // Tells us if the expression evaluates to an int or float, which is necessary for assembly
+    ArenaArray<TokenType> expr_types;
 
-struct NodeBinExprDiv{
-    NodeExpr* lhs;
-    NodeExpr* rhs;
-};
+    ArenaArray<TermKind> term_kinds;
+    ArenaArray<uint32_t> term_payloads;
+    // Int literals are the only payload that doesn't fit in 32 bits
+    ArenaArray<uint64_t> int_lits;
 
-// NOde for expressions that let us add or multiply numbers in the correct order of operations
-struct NodeBinExpr {
-    std::variant<NodeBinExprAdd*, NodeBinExprMulti*, NodeBinExprSub*, NodeBinExprDiv*> var;
-};
+    ArenaArray<NodeBinExpr> bins;
 
-// Node for a paranthesised expression, like (10 + 1) / 11
-struct NodeTermParan {
-    NodeExpr* expr;
-};
+    inline ExprId add_expr(ExprKind kind, uint32_t payload, TokenType int_or_float) {
+        expr_kinds.push_back(kind);
+        expr_payloads.push_back(payload);
+        expr_types.push_back(int_or_float);
+        return ExprId(expr_kinds.size() - 1);
+    }
 
+    inline TermId add_term(TermKind kind, uint32_t payload) {
+        term_kinds.push_back(kind);
+        term_payloads.push_back(payload);
+        return TermId(term_kinds.size() - 1);
+    }
 
-// Expressions fit either terms or NodeBinExpr, and a term fits either int_lit or identifier
-struct NodeTerm {
-    std::variant<NodeTermIntLit*, NodeTermIdent*, NodeTermParan*, NodeTermFloatLit*> var;
-};
+    inline BinExprId add_bin(const NodeBinExpr& bin) {
+        bins.push_back(bin);
+        return BinExprId(bins.size() - 1);
+    }
 
-struct NodeExpr {
-    std::variant<NodeTerm*, NodeBinExpr*> var;
-    TokenType int_or_float;
+    // Empty, keeping the memory
+    inline void clear() {
+        expr_kinds.clear();
+        expr_payloads.clear();
+        expr_types.clear();
+        term_kinds.clear();
+        term_payloads.clear();
+        int_lits.clear();
+        bins.clear();
+    }
+
+    // Empty, for when the arena is about to be reset
+    inline void reset() {
+        expr_kinds.reset();
+        expr_payloads.reset();
+        expr_types.reset();
+        term_kinds.reset();
+        term_payloads.reset();
+        int_lits.reset();
+        bins.reset();
+    }
 };
 
-struct NodeStmtExit {
-    NodeExpr* expr;
+// Payload is the ExprId for exit, the ScopeId for scopes, and an index into lets/ifs/assigns for the rest
+enum class StmtKind : uint8_t {
+    exit,
+    let,
+    scope,
+    if_,
+    assign,
 };
 
 struct NodeStmtLet {
-    Token ident;
-    NodeExpr* expr;
+    SymbolId ident;
+    ExprId expr;
     TokenType int_or_float;
 };
 
-// Forward declare because stmts can have scopes, which have lists of statements
-struct NodeStmt;
+// For variable reassignment, like x = 7;
+struct NodeStmtAssign {
+    SymbolId ident;
+    ExprId expr;
+};
 
+// Statements are in preorder, so a scope's statements are all the ones from first up to end, stepping over anything
+// nested inside them with stmt_next
 struct NodeScope {
-    std::vector<NodeStmt*> stmts;
+    StmtId first;
+    StmtId end;
 };
 
-struct NodeIfPred;
+struct NodeStmtIf {
+    ExprId expr;
+    ScopeId scope;
+    IfPredId pred = no_node;
+};
 
-struct NodeIfPredElif {
-    NodeExpr* expr{};
-    NodeScope* scope{};
-    std::optional<NodeIfPred*> pred;
+// If predicates can be else or elif, payload is an index into elifs or the else's ScopeId
+enum class IfPredKind : uint8_t {
+    elif,
+    else_,
 };
 
-struct NodeIfPredElse {
-    NodeScope* scope;
+struct NodeIfPredElif {
+    ExprId expr;
+    ScopeId scope;
+    IfPredId pred = no_node;
 };
 
-struct NodeIfPred {
-    std::variant<NodeIfPredElif*, NodeIfPredElse*> var;
+// A node representing the program as a list of statements to parse, along with everything those are made of.
+// Every pool lives in arena, which belongs to the program, so it can't be copied
+struct NodeProg {
+    inline NodeProg()
+        : stmt_kinds(arena),
+          stmt_payloads(arena),
+          stmt_next(arena),
+          lets(arena),
+          assigns(arena),
+          scopes(arena),
+          ifs(arena),
+          pred_kinds(arena),
+          pred_payloads(arena),
+          elifs(arena),
+          exprs(arena)
+    {}
 
-};
+    ArenaAllocator arena;
 
-struct NodeStmtIf {
-    NodeExpr* expr;
-    NodeScope* scope;
-    std::optional<NodeIfPred*> pred;
-};
+    ArenaArray<StmtKind> stmt_kinds;
+    ArenaArray<uint32_t> stmt_payloads;
+    // The statement after this one and everything inside it, the top level statements are 0, stmt_next[0], ...
+    ArenaArray<StmtId> stmt_next;
 
-// For variable reassignment, like x = 7;
-struct NodeStmtAssign {
-    Token ident;
-    NodeExpr* expr{};
-};
+    ArenaArray<NodeStmtLet> lets;
+    ArenaArray<NodeStmtAssign> assigns;
+    ArenaArray<NodeScope> scopes;
+    ArenaArray<NodeStmtIf> ifs;
 
-// Node representing statements, like setting variables with let, exit statements, etc..
-struct NodeStmt {
-    std::variant<NodeStmtExit*, NodeStmtLet*, NodeScope*, NodeStmtIf*, NodeStmtAssign*> var;
-};
+    ArenaArray<IfPredKind> pred_kinds;
+    ArenaArray<uint32_t> pred_payloads;
+    ArenaArray<NodeIfPredElif> elifs;
 
-// A node representing the program as a list of statements to parse
-struct NodeProg {
-    std::vector<NodeStmt*> stmts;
+    ExprPools exprs;
+
+    inline StmtId stmt_count() const {
+        return StmtId(stmt_kinds.size());
+    }
+
+    // Empty, but hang onto the memory for the next program: the arena rewinds and keeps its chunks
+    inline void clear() {
+        stmt_kinds.reset();
+        stmt_payloads.reset();
+        stmt_next.reset();
+        lets.reset();
+        assigns.reset();
+        scopes.reset();
+        ifs.reset();
+        pred_kinds.reset();
+        pred_payloads.reset();
+        elifs.reset();
+        exprs.reset();
+        arena.reset();
+    }
+
+    // Tack the statements of a program parsed on its own onto the end of this one, as if they had been parsed right
+    // after ours. Its nodes go after ours in every pool, so everything in it that points at a node moves up by however
+    // many of that kind of node we already had
+    inline void append(const NodeProg& other) {
+        const StmtId stmt_base = stmt_count();
+        const uint32_t let_base = lets.size();
+        const uint32_t assign_base = assigns.size();
+        const ScopeId scope_base = scopes.size();
+        const uint32_t if_base = ifs.size();
+        const IfPredId pred_base = pred_kinds.size();
+        const uint32_t elif_base = elifs.size();
+        const ExprId expr_base = exprs.expr_kinds.size();
+        const TermId term_base = exprs.term_kinds.size();
+        const uint32_t int_lit_base = exprs.int_lits.size();
+        const BinExprId bin_base = exprs.bins.size();
+        auto rebase_pred = [&](IfPredId pred) {
+            return pred == no_node ? no_node : pred + pred_base;
+        };
+
+        stmt_kinds.append(other.stmt_kinds);
+        for (StmtId stmt = 0; stmt < other.stmt_count(); stmt++) {
+            uint32_t payload = other.stmt_payloads[stmt];
+            switch (other.stmt_kinds[stmt]) {
+                case StmtKind::exit:
+                    payload += expr_base;
+                    break;
+                case StmtKind::let:
+                    payload += let_base;
+                    break;
+                case StmtKind::scope:
+                    payload += scope_base;
+                    break;
+                case StmtKind::if_:
+                    payload += if_base;
+                    break;
+                case StmtKind::assign:
+                    payload += assign_base;
+                    break;
+            }
+            stmt_payloads.push_back(payload);
+            stmt_next.push_back(other.stmt_next[stmt] + stmt_base);
+        }
+
+        for (NodeStmtLet let : other.lets) {
+            let.expr += expr_base;
+            lets.push_back(let);
+        }
+        for (NodeStmtAssign assign : other.assigns) {
+            assign.expr += expr_base;
+            assigns.push_back(assign);
+        }
+        for (const NodeScope& scope : other.scopes) {
+            scopes.push_back({.first = scope.first + stmt_base, .end = scope.end + stmt_base});
+        }
+        for (const NodeStmtIf& stmt_if : other.ifs) {
+            ifs.push_back({.expr = stmt_if.expr + expr_base, .scope = stmt_if.scope + scope_base, .pred = rebase_pred(stmt_if.pred)});
+        }
+
+        pred_kinds.append(other.pred_kinds);
+        for (IfPredId pred = 0; pred < other.pred_kinds.size(); pred++) {
+            uint32_t base = other.pred_kinds[pred] == IfPredKind::elif ? elif_base : scope_base;
+            pred_payloads.push_back(other.pred_payloads[pred] + base);
+        }
+        for (const NodeIfPredElif& elif : other.elifs) {
+            elifs.push_back({.expr = elif.expr + expr_base, .scope = elif.scope + scope_base, .pred = rebase_pred(elif.pred)});
+        }
+
+        const ExprPools& from = other.exprs;
+        exprs.expr_kinds.append(from.expr_kinds);
+        exprs.expr_types.append(from.expr_types);
+        for (ExprId expr = 0; expr < from.expr_kinds.size(); expr++) {
+            uint32_t base = from.expr_kinds[expr] == ExprKind::term ? term_base : bin_base;
+            exprs.expr_payloads.push_back(from.expr_payloads[expr] + base);
+        }
+        exprs.term_kinds.append(from.term_kinds);
+        for (TermId term = 0; term < from.term_kinds.size(); term++) {
+            uint32_t payload = from.term_payloads[term];
+            // Floats and identifiers carry their value, not an index
+            if (from.term_kinds[term] == TermKind::int_lit) {
+                payload += int_lit_base;
+            } else if (from.term_kinds[term] == TermKind::paran) {
+                payload += expr_base;
+            }
+            exprs.term_payloads.push_back(payload);
+        }
+        exprs.int_lits.append(from.int_lits);
+        for (NodeBinExpr bin : from.bins) {
+            bin.lhs += expr_base;
+            bin.rhs += expr_base;
+            exprs.bins.push_back(bin);
+        }
+    }
 };
 
-// This parsing works very similarly to tokenizer, peek while we have tokens to peek.
+/*
+ * Where to cut a program's tokens so every piece is whole top level statements, for parsing the pieces on their own.
+ * Finding that only needs token kinds: a top level statement ends at a ';' outside any {}, or at the '}' that closes
+ * it, unless an elif or else comes next and carries on the if. We want about parts pieces, so we cut at the first
+ * statement end past each part's share of the tokens.
+ * Hands back where each piece starts, plus tokens.size() at the end. If the program doesn't parse the cuts can be
+ * anywhere, but then neither will some piece.
+ */
+inline std::vector<size_t> find_stmt_cuts(const TokenStore& tokens, size_t parts) {
+    std::vector<size_t> starts {0};
+    const size_t size = tokens.size();
+    size_t target = size / parts;
+    int64_t depth = 0;
+    for (size_t i = 0; i < size && starts.size() < parts; i++) {
+        TokenType type = tokens.kind(i);
+        if (type == TokenType::open_curly) {
+            depth++;
+        } else if (type == TokenType::close_curly) {
+            depth--;
+        }
+        if (i + 1 < target || depth != 0) {
+            continue;
+        }
+        // Past the end kind() is eof, so the lookahead is always fine
+        bool ends_stmt = type == TokenType::semi
+            || (type == TokenType::close_curly && tokens.kind(i + 1) != TokenType::elif && tokens.kind(i + 1) != TokenType::else_);
+        if (ends_stmt && i + 1 < size) {
+            starts.push_back(i + 1);
+            target = size / parts * starts.size();
+        }
+    }
+    starts.push_back(size);
+    return starts;
+}
+
+/*
+ * This parsing works very similarly to tokenizer, peek while we have tokens to peek.
+ * One parser can parse any number of programs one after another, the tree it hands back is good until the next
+ * parse_prog, which reuses all of its memory.
+ */
 class Parser {
 public:
-    inline explicit Parser(std::vector<Token>& tokens)
-            : m_tokens(std::move(tokens)),
-              m_allocator(1024 * 1024 * 4) // 4MB
-    {}
-
     // Recall static on a member function menas you can call it without making object, so Parser::error_expected()
-    void error_expected(const std::string& msg) {
-        std::cerr << "[Parse Error] Expected " << msg <<"' on line " << peek(-1).value().line << std::endl;
-        exit(EXIT_FAILURE);
+    [[noreturn]] void error_expected(std::string_view msg) {
+        // Tokens only know their offset, work out the line and column now that we actually need them
+        SourceLocation location = LineIndex(m_tokens->source()).locate(m_tokens->previous().offset);
+        throw CompileError(at_location("[Parse Error] Expected " + std::string(msg) + "'", location), location);
     }
 
     // Parse an if predicate, which can be else or elif or nothing
-    std::optional<NodeIfPred*> parse_if_pred() {
+    std::optional<IfPredId> parse_if_pred() {
         if (try_consume(TokenType::elif)) {
-            auto elif = m_allocator.alloc<NodeIfPredElif>();
+            // Take our slots before parsing what's inside so we come before it
+            uint32_t elif = m_prog.elifs.size();
+            IfPredId pred = add_pred(IfPredKind::elif, elif);
+            m_prog.elifs.push_back({});
             try_consume(TokenType::open_paran, "Missing '('");
             if (auto expr = parse_expr()) {
-                elif->expr = expr.value();
+                m_prog.elifs[elif].expr = expr.value();
             } else {
                 error_expected("Expression");
             }
             try_consume(TokenType::close_paran, "')'");
             if (auto scope = parse_scope()) {
-                elif->scope = scope.value();
+                m_prog.elifs[elif].scope = scope.value();
             } else {
                 error_expected("Scope");
             }
             // Recursive
-            elif->pred = parse_if_pred();
-            auto pred = m_allocator.alloc<NodeIfPred>();
-            pred->var = elif;
+            m_prog.elifs[elif].pred = parse_if_pred().value_or(no_node);
             return pred;
         }
         if (try_consume(TokenType::else_)) {
-            auto else_ = m_allocator.alloc<NodeIfPredElse>();
+            IfPredId pred = add_pred(IfPredKind::else_, no_node);
             if (auto scope = parse_scope()) {
-                else_->scope = scope.value();
+                m_prog.pred_payloads[pred] = scope.value();
             } else {
                 error_expected("Scope");
             }
-            auto pred = m_allocator.alloc<NodeIfPred>();
-            pred->var = else_;
             return pred;
         }
         return {};
     }
 
     // Parse a scope
-    std::optional<NodeScope*> parse_scope() {
+    std::optional<ScopeId> parse_scope() {
         if (!try_consume(TokenType::open_curly)) {
             return {};
         }
-        auto scope = m_allocator.alloc<NodeScope>();
-        while (auto stmt = parse_stmt()) {
-            scope->stmts.push_back(stmt.value());
+        ScopeId scope = m_prog.scopes.size();
+        m_prog.scopes.push_back({.first = m_prog.stmt_count(), .end = no_node});
+        while (parse_stmt()) {
         }
         try_consume(TokenType::close_curly, "'}'");
+        m_prog.scopes[scope].end = m_prog.stmt_count();
         return scope;
     }
 
-    // Parse terms, which are identifiers or ints/floats or other expressions
-    std::optional<NodeTerm*> parse_term() {
+    // Parse terms, which are identifiers or ints/floats. Parantheses are up to parse_subexpr
+    std::optional<TermId> parse_term() {
         if (auto int_lit = try_consume(TokenType::int_lit)) {
-            auto term_int_lit = m_allocator.alloc<NodeTermIntLit>();
-            term_int_lit->int_lit = int_lit.value();
-            auto term = m_allocator.alloc<NodeTerm>();
-            term->var = term_int_lit;
-            return term;
+            m_scratch.int_lits.push_back(int_lit->literal);
+            return m_scratch.add_term(TermKind::int_lit, m_scratch.int_lits.size() - 1);
         } else if (auto float_lit = try_consume(TokenType::float_lit)) {
-            auto term_float_lit = m_allocator.alloc<NodeTermFloatLit>();
-            term_float_lit->float_lit = float_lit.value();
-            auto term = m_allocator.alloc<NodeTerm>();
-            term->var = term_float_lit;
-            return term;
+            return m_scratch.add_term(TermKind::float_lit, float_lit->literal);
         } else if (auto ident = try_consume(TokenType::ident)) {
-            auto term_ident = m_allocator.alloc<NodeTermIdent>();
-            term_ident->ident = ident.value();
-            auto term = m_allocator.alloc<NodeTerm>();
-            term->var = term_ident;
-            return term;
-        } else if (auto paran = try_consume(TokenType::open_paran)) {
-            // This case is for if we encounter parans used for containing expressions of highest precendence
-            auto term_paran = m_allocator.alloc<NodeTermParan>();
-            auto expr = parse_expr();
-            if (!expr.has_value()) {
-                error_expected("expression");
-            }
-            try_consume(TokenType::close_paran, "')'");
-            term_paran->expr = expr.value();
-            auto term = m_allocator.alloc<NodeTerm>();
-            term->var = term_paran;
-            term_paran->expr->int_or_float = expr.value()->int_or_float;
-            return term;
+            return m_scratch.add_term(TermKind::ident, ident->symbol);
         } else {
             return {};
         }
     }
 
-    // Function to parse an expression, which are things like terms or binary expressions
-    std::optional<NodeExpr*> parse_expr(int min_prec = 0) {
-
-        /* Begin implementation of precedence climbing*/
-        std::optional<NodeTerm*> term_lhs = parse_term();
-
-        // This tells us if this overall expression evaluates to an int or float, which is necessary for assembly
-        TokenType int_or_float = TokenType::float_lit;
-        if (term_lhs.value()->var.index() == 0) {
-            int_or_float = TokenType::int_lit;
-        }
-
-        // Doing this bc add->lhs or mult->lhs is an expr, and we currently have it as a term, so we need to transfer
-        auto expr_lhs = m_allocator.alloc<NodeExpr>();
-        expr_lhs->var = term_lhs.value();
-        expr_lhs->int_or_float = int_or_float;
-        if (!term_lhs.has_value()) {
-            return {};
+    /*
+     * Function to parse an expression, which are things like terms or binary expressions
+     * A binary expression gets built after both of its sides, which is backwards from how Generator walks it. So the
+     * expression gets parsed into m_scratch first, then copied into the tree in preorder.
+     */
+    std::optional<ExprId> parse_expr() {
+        std::optional<ExprId> expr = parse_subexpr();
+        if (expr.has_value()) {
+            expr = copy_expr(expr.value());
         }
+        m_scratch.clear();
+        return expr;
+    }
 
-        while(1) {
-            std::optional<Token> curr_tok = peek();
-            std::optional<int> prec;
-            // If token does exist, but either wrong precedence
-            if (curr_tok.has_value()) {
-                prec = bin_prec(curr_tok->type);
-                if (!prec.has_value() || prec < min_prec) {
-                    break;
+    /*
+     * Precedence climbing with our own stacks instead of recursion (shunting-yard). Finished operands wait on
+     * m_operands and operators wait on m_operators until we know nothing on their right binds tighter, then reduce()
+     * turns them into binary expressions. Each '(' waits on m_operators too, so however deep parantheses nest only
+     * those stacks grow, never the native one.
+     * The expression it returns is in m_scratch.
+     */
+    std::optional<ExprId> parse_subexpr() {
+        m_operands.clear();
+        m_operators.clear();
+        // What's missing if there's no term where there should be one. At the very start that's for our caller to say
+        const char* missing = nullptr;
+        while (true) {
+            // Any number of '(' and then a term
+            while (try_consume(TokenType::open_paran)) {
+                m_operators.push_back({.op = BinOp::add, .prec = paran_prec});
+                missing = "expression";
+            }
+            std::optional<TermId> term = parse_term();
+            if (!term.has_value()) {
+                if (missing == nullptr) {
+                    return {};
                 }
-            } else {
-                // Token does not have value
-                break;
+                error_expected(missing);
             }
 
-            Token op = consume();
-            // Get rhs with additional precedence
-            int next_min_prec = prec.value() + 1;
-            auto expr_rhs = parse_expr(next_min_prec);
-
-            if (!expr_rhs.has_value()) {
-                error_expected("expression: ");
+            // This tells us if the expression evaluates to an int or float, which is necessary for assembly. An
+            // expression takes it from its first term, so binary expressions pass theirs on from their lhs
+            TokenType int_or_float = TokenType::float_lit;
+            if (m_scratch.term_kinds[term.value()] == TermKind::int_lit) {
+                int_or_float = TokenType::int_lit;
             }
-            // We know current token is binary operator, so we can consume and do recursive call
-            auto expr = m_allocator.alloc<NodeBinExpr>();
-            auto expr_lhs2 = m_allocator.alloc<NodeExpr>();
-            if (op.type == TokenType::plus) {
-                auto add = m_allocator.alloc<NodeBinExprAdd>();
-                expr_lhs2->var = expr_lhs->var;
-                expr_lhs2->int_or_float = expr_lhs->int_or_float;
-                add->lhs = expr_lhs2;
-                add->rhs = expr_rhs.value();
-                add->rhs->int_or_float = expr_rhs.value()->int_or_float;
-                expr->var = add;
-            } else if (op.type == TokenType::star) {
-                auto star = m_allocator.alloc<NodeBinExprMulti>();
-                expr_lhs2->var = expr_lhs->var;
-                expr_lhs2->int_or_float = expr_lhs->int_or_float;
-                star->lhs = expr_lhs2;
-                star->rhs = expr_rhs.value();
-                star->rhs->int_or_float = expr_rhs.value()->int_or_float;
-                expr->var = star;
-            } else if (op.type == TokenType::sub) {
-                auto sub = m_allocator.alloc<NodeBinExprSub>();
-                expr_lhs2->var = expr_lhs->var;
-                expr_lhs2->int_or_float = expr_lhs->int_or_float;
-                sub->lhs = expr_lhs2;
-                sub->rhs = expr_rhs.value();
-                sub->rhs->int_or_float = expr_rhs.value()->int_or_float;
-                expr->var = sub;
-            } else if (op.type == TokenType::div) {
-                auto div = m_allocator.alloc<NodeBinExprDiv>();
-                expr_lhs2->var = expr_lhs->var;
-                expr_lhs2->int_or_float = expr_lhs->int_or_float;
-                div->lhs = expr_lhs2;
-                div->rhs = expr_rhs.value();
-                div->rhs->int_or_float = expr_rhs.value()->int_or_float;
-                expr->var = div;
+            m_operands.push_back(m_scratch.add_expr(ExprKind::term, term.value(), int_or_float));
+
+            // Then whatever ')' close here, up to the next operator
+            while (true) {
+                // Stop if the next token isn't a binary operator (eof isn't one either)
+                std::optional<int> prec = bin_prec(peek_type());
+                if (prec.has_value()) {
+                    // Everything waiting that binds at least as tight is done, that's what makes a - b - c (a - b) - c
+                    reduce(prec.value());
+                    m_operators.push_back({.op = bin_op(consume().type), .prec = prec.value()});
+                    missing = "expression: ";
+                    break;
+                }
+                reduce(0);
+                if (m_operators.empty()) {
+                    return m_operands.back();
+                }
+                // Still inside parantheses, so they have to close here
+                try_consume(TokenType::close_paran, "')'");
+                m_operators.pop_back();
+                TermId paran = m_scratch.add_term(TermKind::paran, m_operands.back());
+                m_operands.back() = m_scratch.add_expr(ExprKind::term, paran, TokenType::float_lit);
             }
-            expr_lhs->var = expr;
-            expr_lhs->int_or_float = int_or_float;
         }
-        return expr_lhs;
-        /* ENd implmentation of precedence climbing */
-
     }
 
         // Function to parse statements, such as functions like let, or exits, etc.
-        std::optional<NodeStmt*> parse_stmt() {
+        std::optional<StmtId> parse_stmt() {
             // Exit statement case
-            if (peek().has_value() && peek().value().type == TokenType::exit && peek(1).has_value() &&
-                peek(1).value().type == TokenType::open_paran) {
-                // Make NodeStmtExit* in arena allocator
-                auto node_stmt_exit = m_allocator.alloc<NodeStmtExit>();
+            if (peek_type() == TokenType::exit && peek_type(1) == TokenType::open_paran) {
+                StmtId stmt = begin_stmt(StmtKind::exit);
 
                 // Consume exit token and open paranthesis token
                 consume();
@@ -325,149 +522,305 @@ public:
                 // node_expr will be true if parse_expr returned something, false o/w
                 if (auto node_expr = parse_expr()) {
                     // if there was an expression to parse, we give this exit node the expression to parse as well before returning it in main.
-                    node_stmt_exit->expr = node_expr.value();
+                    m_prog.stmt_payloads[stmt] = node_expr.value();
                 } else {
                     error_expected("Expression");
                 }
                 try_consume(TokenType::close_paran, "')'");
                 try_consume(TokenType::semi, "';'");
-
-                // Make return statement
-                auto node_stmt_return = m_allocator.alloc<NodeStmt>();
-                node_stmt_return->var = node_stmt_exit;
-                return node_stmt_return;
+                return end_stmt(stmt);
 
             // "let" statment case for setting variables
-            } else if (peek().value().type == TokenType::let && peek(1).has_value() &&
-            peek(1).value().type == TokenType::ident && peek(2).has_value() && peek(2).value().type == TokenType::equals) {
+            } else if (peek_type() == TokenType::let && peek_type(1) == TokenType::ident && peek_type(2) == TokenType::equals) {
+                StmtId stmt = begin_stmt(StmtKind::let);
                 // Consume let token
                 consume();
 
-                // Make NodeStmtLet*
-                auto node_stmt_let = m_allocator.alloc<NodeStmtLet>();
-                node_stmt_let->ident = consume();
+                NodeStmtLet node_stmt_let{.ident = consume().symbol, .expr = no_node, .int_or_float = TokenType::int_lit};
 
                 // Get rid of equals token
                 consume();
 
-                // Could potentially add here a way to distinguish if next token is float or int in node
-
                 // Parse expression after equals, c
                 if (auto expr = parse_expr()) {
-                    node_stmt_let->expr = expr.value();
-                    node_stmt_let->int_or_float = expr.value()->int_or_float;
+                    node_stmt_let.expr = expr.value();
+                    node_stmt_let.int_or_float = m_prog.exprs.expr_types[expr.value()];
                 } else {
                     error_expected("expression");
                 }
                 // Check for ending semicolon
                 try_consume(TokenType::semi, "';'");
-                auto node_stmt_return = m_allocator.alloc<NodeStmt>();
-                node_stmt_return->var = node_stmt_let;
-                return node_stmt_return;
+                m_prog.stmt_payloads[stmt] = m_prog.lets.size();
+                m_prog.lets.push_back(node_stmt_let);
+                return end_stmt(stmt);
 
             // Variable assignment, i.e. x = 1;
-            } else if (peek().has_value() && peek().value().type == TokenType::ident &&
-            peek(1).has_value() && peek(1).value().type == TokenType::equals) {
-                auto node_stmt_assign = m_allocator.alloc<NodeStmtAssign>();
-                node_stmt_assign->ident = consume();
+            } else if (peek_type() == TokenType::ident && peek_type(1) == TokenType::equals) {
+                StmtId stmt = begin_stmt(StmtKind::assign);
+                NodeStmtAssign node_stmt_assign{.ident = consume().symbol, .expr = no_node};
 
                 //Get rid of equals
                 consume();
 
                 if (auto expr = parse_expr()) {
-                    node_stmt_assign->expr = expr.value();
-                    node_stmt_assign->expr->int_or_float = expr.value()->int_or_float;
+                    node_stmt_assign.expr = expr.value();
                 } else {
                     error_expected("let");
                 }
                 // Check for ending semicolon
                 try_consume(TokenType::semi, "';'");
-                auto node_stmt_return = m_allocator.alloc<NodeStmt>();
-                node_stmt_return->var = node_stmt_assign;
-                return node_stmt_return;
+                m_prog.stmt_payloads[stmt] = m_prog.assigns.size();
+                m_prog.assigns.push_back(node_stmt_assign);
+                return end_stmt(stmt);
 
             // Scopes
-            } else if (peek().has_value() && peek().value().type == TokenType::open_curly) {
+            } else if (peek_type() == TokenType::open_curly) {
+                StmtId stmt = begin_stmt(StmtKind::scope);
                 if (auto scope = parse_scope()) {
-                    auto stmt = m_allocator.alloc<NodeStmt>();
-                    stmt->var = scope.value();
-                    return stmt;
+                    m_prog.stmt_payloads[stmt] = scope.value();
+                    return end_stmt(stmt);
                 } else {
                     error_expected("scope");
                 }
 
             // If statements
-            } else if (auto if_ = try_consume(TokenType::if_)){
+            } else if (peek_type() == TokenType::if_) {
+                StmtId stmt = begin_stmt(StmtKind::if_);
+                consume();
                 try_consume(TokenType::open_paran, "'(");
-                auto stmt_if = m_allocator.alloc<NodeStmtIf>();
+                uint32_t stmt_if = m_prog.ifs.size();
+                m_prog.stmt_payloads[stmt] = stmt_if;
+                m_prog.ifs.push_back({});
                 if (auto expr = parse_expr()) {
-                    stmt_if->expr = expr.value();
+                    m_prog.ifs[stmt_if].expr = expr.value();
                 } else {
                     error_expected("expression");
                 }
                 try_consume(TokenType::close_paran, "')");
                 if (auto scope = parse_scope()) {
-                    stmt_if->scope = scope.value();
+                    m_prog.ifs[stmt_if].scope = scope.value();
                 } else {
                     error_expected("scope");
                 }
-                stmt_if->pred = parse_if_pred();
-                auto stmt = m_allocator.alloc<NodeStmt>();
-                stmt->var = stmt_if;
-                return stmt;
+                m_prog.ifs[stmt_if].pred = parse_if_pred().value_or(no_node);
+                return end_stmt(stmt);
             } else {
                 return {};
             }
             return {};
         }
 
-        // Function that parses an entire program, token by token
-        std::optional<NodeProg*> parse_prog() {
-            // Given a list of tokens, so we have to keep going until tno more tokens
-            auto node_prog = m_allocator.alloc<NodeProg>();
-            while (peek().has_value()) {
-                if (auto stmt = parse_stmt()) {
-                    node_prog->stmts.push_back(stmt.value());
-                } else {
-                    error_expected("statement");
+        // Parse an entire program, token by token. Tokens get pulled out of the tokenizer as we go
+        const NodeProg& parse_prog(Tokenizer& tokenizer) {
+            m_tokens.emplace(tokenizer);
+            return parse_prog();
+        }
+
+        // Same thing, but for tokens that were all made up front (see tokenize_parallel). With more than one thread,
+        // big programs get cut into runs of whole statements (see find_stmt_cuts) that are parsed at the same time, each
+        // by its own Parser into its own pools, and then stitched together in order with NodeProg::append. That gives
+        // the exact tree parsing it all in one go would have.
+        // If any piece has an error we throw all of that away and parse the whole thing again on this thread, so the
+        // error we report is the same one we'd report without threads
+        const NodeProg& parse_prog(const TokenStore& tokens, size_t threads = 1) {
+            // Not worth waking threads up for less than this per piece
+            constexpr size_t min_piece_tokens = 64 * 1024;
+            size_t parts = std::min(threads, tokens.size() / min_piece_tokens);
+            std::vector<size_t> starts;
+            if (parts > 1) {
+                starts = find_stmt_cuts(tokens, parts);
+            }
+            // A program that's one huge statement can't be cut at all
+            if (starts.size() > 2) {
+                size_t pieces = starts.size() - 1;
+                while (m_pieces.size() < pieces) {
+                    m_pieces.push_back(std::make_unique<Parser>());
+                }
+                bool parsed = true;
+                try {
+                    parallel_for(pieces, threads, [&](size_t i) {
+                        m_pieces[i]->m_tokens.emplace(tokens, starts[i], starts[i + 1]);
+                        m_pieces[i]->parse_prog();
+                    });
+                } catch (const CompileError&) {
+                    parsed = false;
+                }
+                if (parsed) {
+                    m_prog.clear();
+                    for (size_t i = 0; i < pieces; i++) {
+                        m_prog.append(m_pieces[i]->m_prog);
+                    }
+                    return m_prog;
                 }
             }
-            return node_prog;
+            m_tokens.emplace(tokens);
+            return parse_prog();
         }
     private:
-        inline std::optional<Token> peek(int offset = 0) const {
-            if (m_index + offset >= m_tokens.size()) {
-                // OOB
-                return {};
-            } else {
-                return m_tokens[m_index + offset];
+        const NodeProg& parse_prog() {
+            m_prog.clear();
+            m_scratch.clear();
+            // Given a list of tokens, so we have to keep going until tno more tokens
+            while (peek_type() != TokenType::eof) {
+                if (!parse_stmt()) {
+                    error_expected("statement");
+                }
             }
+            return m_prog;
         }
 
-        inline Token try_consume(TokenType type, const std::string& err_msg) {
-            if (peek().has_value() && peek().value().type == type) {
-                return consume();
-            } else {
+        // Deciding what to parse next only needs token types, past the end of the tokens this is eof
+        inline TokenType peek_type(int offset = 0) {
+            return m_tokens->peek_type(offset);
+        }
+
+        inline const Token& try_consume(TokenType type, std::string_view err_msg) {
+            if (peek_type() != type) {
                 error_expected(err_msg);
-                return {};
             }
+            return consume();
         }
 
-        inline std::optional<Token> try_consume(TokenType type) {
-            if (peek().has_value() && peek().value().type == type) {
-                return consume();
+        // Pointer to the consumed token if it was the type we wanted, nullptr (and nothing consumed) if not
+        inline const Token* try_consume(TokenType type) {
+            if (peek_type() == type) {
+                return &consume();
             } else {
-                return {};
+                return nullptr;
             }
         }
 
-        inline Token consume() {
-            // returns value @m_index, then increments
-            return m_tokens[m_index++];
+        // Reference is good until the next consume
+        inline const Token& consume() {
+            return m_tokens->consume();
+        }
+
+        // Statements take their slot before anything inside them gets parsed, that's what keeps them in preorder
+        inline StmtId begin_stmt(StmtKind kind) {
+            m_prog.stmt_kinds.push_back(kind);
+            m_prog.stmt_payloads.push_back(no_node);
+            m_prog.stmt_next.push_back(no_node);
+            return m_prog.stmt_count() - 1;
+        }
+
+        // Everything parsed since begin_stmt was inside the statement, so the next one starts here
+        inline StmtId end_stmt(StmtId stmt) {
+            m_prog.stmt_next[stmt] = m_prog.stmt_count();
+            return stmt;
+        }
+
+        inline IfPredId add_pred(IfPredKind kind, uint32_t payload) {
+            m_prog.pred_kinds.push_back(kind);
+            m_prog.pred_payloads.push_back(payload);
+            return IfPredId(m_prog.pred_kinds.size() - 1);
+        }
+
+        static inline BinOp bin_op(TokenType type) {
+            switch (type) {
+                case TokenType::star:
+                    return BinOp::multi;
+                case TokenType::sub:
+                    return BinOp::sub;
+                case TokenType::div:
+                    return BinOp::div;
+                default:
+                    return BinOp::add;
+            }
+        }
+
+        // Turn waiting operators into binary expressions for as long as they bind at least as tight as min_prec. A '('
+        // binds looser than anything, so this never reaches past one
+        void reduce(int min_prec) {
+            while (!m_operators.empty() && m_operators.back().prec >= min_prec) {
+                NodeBinExpr bin{.lhs = no_node, .rhs = no_node, .op = m_operators.back().op, .int_or_float = TokenType::int_lit};
+                m_operators.pop_back();
+                bin.rhs = m_operands.back();
+                m_operands.pop_back();
+                bin.lhs = m_operands.back();
+                if (m_scratch.expr_types[bin.lhs] == TokenType::float_lit || m_scratch.expr_types[bin.rhs] == TokenType::float_lit) {
+                    bin.int_or_float = TokenType::float_lit;
+                }
+                // The new expression takes the place of its lhs, along with its type no matter what the operation is done on
+                m_operands.back() = m_scratch.add_expr(ExprKind::bin_expr, m_scratch.add_bin(bin), m_scratch.expr_types[bin.lhs]);
+            }
+        }
+
+        // Copy an expression out of m_scratch into the tree, each node ahead of its children and the rhs ahead of the
+        // lhs, since that's the order Generator evaluates them in. Uses a stack for the same reason parse_subexpr does
+        ExprId copy_expr(ExprId root) {
+            ExprPools& exprs = m_prog.exprs;
+            ExprId copied_root = ExprId(exprs.expr_kinds.size());
+            m_copies.push_back({.from = root, .slot = CopySlot::root});
+            while (!m_copies.empty()) {
+                PendingCopy pending = m_copies.back();
+                m_copies.pop_back();
+
+                ExprId expr = exprs.add_expr(m_scratch.expr_kinds[pending.from], no_node, m_scratch.expr_types[pending.from]);
+                // Now we know where it went, point its parent at it
+                if (pending.slot == CopySlot::lhs) {
+                    exprs.bins[pending.parent].lhs = expr;
+                } else if (pending.slot == CopySlot::rhs) {
+                    exprs.bins[pending.parent].rhs = expr;
+                } else if (pending.slot == CopySlot::paran) {
+                    exprs.term_payloads[pending.parent] = expr;
+                }
+
+                uint32_t payload = m_scratch.expr_payloads[pending.from];
+                if (m_scratch.expr_kinds[pending.from] == ExprKind::term) {
+                    TermKind kind = m_scratch.term_kinds[payload];
+                    TermId term = exprs.add_term(kind, m_scratch.term_payloads[payload]);
+                    exprs.expr_payloads[expr] = term;
+                    if (kind == TermKind::int_lit) {
+                        exprs.int_lits.push_back(m_scratch.int_lits[m_scratch.term_payloads[payload]]);
+                        exprs.term_payloads[term] = exprs.int_lits.size() - 1;
+                    } else if (kind == TermKind::paran) {
+                        m_copies.push_back({.from = m_scratch.term_payloads[payload], .slot = CopySlot::paran, .parent = term});
+                    }
+                } else {
+                    const NodeBinExpr& bin = m_scratch.bins[payload];
+                    BinExprId copy = exprs.add_bin(bin);
+                    exprs.expr_payloads[expr] = copy;
+                    // Last on comes off first, so the rhs has to go on last
+                    m_copies.push_back({.from = bin.lhs, .slot = CopySlot::lhs, .parent = copy});
+                    m_copies.push_back({.from = bin.rhs, .slot = CopySlot::rhs, .parent = copy});
+                }
+            }
+            return copied_root;
         }
 
-        const std::vector<Token> m_tokens;
-        size_t m_index = 0;
-        ArenaAllocator m_allocator;
+        // Where the program being parsed comes from, parse_prog sets it
+        std::optional<TokenStream> m_tokens;
+        NodeProg m_prog;
+        // Where expressions get built before copy_expr puts them in m_prog, emptied after every expression. It keeps
+        // its own arena, which never needs resetting since the pools just get refilled
+        ArenaAllocator m_scratch_arena;
+        ExprPools m_scratch {m_scratch_arena};
+
+        // An operator waiting for everything on its right that binds tighter, or a '(' waiting for its ')'
+        struct PendingOp {
+            BinOp op;
+            int prec;
+        };
+        static constexpr int paran_prec = -1;
+        std::vector<ExprId> m_operands;
+        std::vector<PendingOp> m_operators;
+
+        // An expression copy_expr still has to copy, and which child of which node it turns into
+        enum class CopySlot : uint8_t {
+            root,
+            lhs,
+            rhs,
+            paran,
+        };
+        struct PendingCopy {
+            ExprId from;
+            CopySlot slot;
+            uint32_t parent = no_node;
+        };
+        std::vector<PendingCopy> m_copies;
+
+        // Parsers for the pieces of a program parsed on several threads, kept so their memory gets reused too. Each has
+        // its own arenas, so the threads never share one
+        std::vector<std::unique_ptr<Parser>> m_pieces;
 
 };
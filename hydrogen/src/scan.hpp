@@ -0,0 +1,209 @@
+// File for the scanning kernels the tokenizer uses to skip over whitespace and comments
+
+#pragma once
+
+#include <cstddef>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define HYDRO_SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+/*
+ * Our generated sources are mostly comments and indentation, so instead of going byte by byte through peek()
+ * the tokenizer hands whole runs of those to these kernels. Each one comes in a scalar version, an SSE2 version
+ * (16 bytes at a time, always there on x86-64) and an AVX2 version (32 bytes at a time), and scan_kernels()
+ * picks the best one the cpu we are running on supports.
+ *
+ * All of them take [p, end) and return a pointer somewhere in that range, or end if they ran off the end.
+ */
+
+// Same set of chars std::isspace() matches in the C locale: ' ', '\t', '\n', '\v', '\f', '\r'
+inline bool is_space_byte(char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+// Scalar fallbacks, also used to finish off the tail the vector versions leave behind
+
+inline const char* scalar_skip_whitespace(const char* p, const char* end) {
+    while (p < end && is_space_byte(*p)) {
+        p++;
+    }
+    return p;
+}
+
+inline const char* scalar_find_line_end(const char* p, const char* end) {
+    while (p < end && *p != '\n') {
+        p++;
+    }
+    return p;
+}
+
+// Returns a pointer to the '*' of the closing "*/"
+inline const char* scalar_find_block_end(const char* p, const char* end) {
+    while (p + 1 < end) {
+        if (p[0] == '*' && p[1] == '/') {
+            return p;
+        }
+        p++;
+    }
+    return end;
+}
+
+inline size_t scalar_count_newlines(const char* p, const char* end) {
+    size_t count = 0;
+    while (p < end) {
+        count += *p++ == '\n';
+    }
+    return count;
+}
+
+#ifdef HYDRO_SCAN_X86
+
+// Byte mask of whitespace in v. The [9, 13] range check is "clamping it into the range didn't change it",
+// since SSE2 has no unsigned byte compares
+inline __m128i sse2_space_mask(__m128i v) {
+    __m128i space = _mm_cmpeq_epi8(v, _mm_set1_epi8(' '));
+    __m128i clamped = _mm_min_epu8(_mm_max_epu8(v, _mm_set1_epi8('\t')), _mm_set1_epi8('\r'));
+    return _mm_or_si128(space, _mm_cmpeq_epi8(clamped, v));
+}
+
+inline const char* sse2_skip_whitespace(const char* p, const char* end) {
+    while (end - p >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*) p);
+        unsigned mask = _mm_movemask_epi8(sse2_space_mask(v));
+        if (mask != 0xFFFF) {
+            // First zero bit is the first char that isn't whitespace
+            return p + __builtin_ctz(~mask);
+        }
+        p += 16;
+    }
+    return scalar_skip_whitespace(p, end);
+}
+
+inline const char* sse2_find_line_end(const char* p, const char* end) {
+    const __m128i newline = _mm_set1_epi8('\n');
+    while (end - p >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*) p);
+        unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, newline));
+        if (mask != 0) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 16;
+    }
+    return scalar_find_line_end(p, end);
+}
+
+inline const char* sse2_find_block_end(const char* p, const char* end) {
+    const __m128i star = _mm_set1_epi8('*');
+    const __m128i slash = _mm_set1_epi8('/');
+    // Second load is shifted by one, so a '*' in lane i followed by '/' means "*/" starts at p + i
+    while (end - p >= 17) {
+        __m128i a = _mm_loadu_si128((const __m128i*) p);
+        __m128i b = _mm_loadu_si128((const __m128i*) (p + 1));
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, star), _mm_cmpeq_epi8(b, slash)));
+        if (mask != 0) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 16;
+    }
+    return scalar_find_block_end(p, end);
+}
+
+inline size_t sse2_count_newlines(const char* p, const char* end) {
+    const __m128i newline = _mm_set1_epi8('\n');
+    size_t count = 0;
+    while (end - p >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*) p);
+        count += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(v, newline)));
+        p += 16;
+    }
+    return count + scalar_count_newlines(p, end);
+}
+
+// AVX2 versions are the same idea 32 bytes at a time. They are compiled for avx2 no matter what flags
+// the rest of the program uses, so they must only ever be called if the cpu says it has avx2
+
+__attribute__((target("avx2"))) inline __m256i avx2_space_mask(__m256i v) {
+    __m256i space = _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' '));
+    __m256i clamped = _mm256_min_epu8(_mm256_max_epu8(v, _mm256_set1_epi8('\t')), _mm256_set1_epi8('\r'));
+    return _mm256_or_si256(space, _mm256_cmpeq_epi8(clamped, v));
+}
+
+__attribute__((target("avx2"))) inline const char* avx2_skip_whitespace(const char* p, const char* end) {
+    while (end - p >= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*) p);
+        unsigned mask = _mm256_movemask_epi8(avx2_space_mask(v));
+        if (mask != 0xFFFFFFFF) {
+            return p + __builtin_ctz(~mask);
+        }
+        p += 32;
+    }
+    return sse2_skip_whitespace(p, end);
+}
+
+__attribute__((target("avx2"))) inline const char* avx2_find_line_end(const char* p, const char* end) {
+    const __m256i newline = _mm256_set1_epi8('\n');
+    while (end - p >= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*) p);
+        unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, newline));
+        if (mask != 0) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 32;
+    }
+    return sse2_find_line_end(p, end);
+}
+
+__attribute__((target("avx2"))) inline const char* avx2_find_block_end(const char* p, const char* end) {
+    const __m256i star = _mm256_set1_epi8('*');
+    const __m256i slash = _mm256_set1_epi8('/');
+    while (end - p >= 33) {
+        __m256i a = _mm256_loadu_si256((const __m256i*) p);
+        __m256i b = _mm256_loadu_si256((const __m256i*) (p + 1));
+        unsigned mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, star), _mm256_cmpeq_epi8(b, slash)));
+        if (mask != 0) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 32;
+    }
+    return sse2_find_block_end(p, end);
+}
+
+__attribute__((target("avx2,popcnt"))) inline size_t avx2_count_newlines(const char* p, const char* end) {
+    const __m256i newline = _mm256_set1_epi8('\n');
+    size_t count = 0;
+    while (end - p >= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*) p);
+        count += __builtin_popcount(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, newline)));
+        p += 32;
+    }
+    return count + sse2_count_newlines(p, end);
+}
+
+#endif
+
+// The set of kernels the tokenizer calls through
+struct ScanKernels {
+    const char* (*skip_whitespace)(const char*, const char*);
+    const char* (*find_line_end)(const char*, const char*);
+    const char* (*find_block_end)(const char*, const char*);
+    size_t (*count_newlines)(const char*, const char*);
+};
+
+inline ScanKernels pick_scan_kernels() {
+#ifdef HYDRO_SCAN_X86
+    if (__builtin_cpu_supports("avx2")) {
+        return {avx2_skip_whitespace, avx2_find_line_end, avx2_find_block_end, avx2_count_newlines};
+    }
+    return {sse2_skip_whitespace, sse2_find_line_end, sse2_find_block_end, sse2_count_newlines};
+#else
+    return {scalar_skip_whitespace, scalar_find_line_end, scalar_find_block_end, scalar_count_newlines};
+#endif
+}
+
+// Checking cpu features is not free, so do it once and hand out the same kernels every time
+inline const ScanKernels& scan_kernels() {
+    static const ScanKernels kernels = pick_scan_kernels();
+    return kernels;
+}
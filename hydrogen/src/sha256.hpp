@@ -0,0 +1,173 @@
+// File for SHA-256, which is how the AST cache tells one source from another
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define HYDRO_SHA_X86 1
+#include <immintrin.h>
+#endif
+
+/*
+ * Plain FIPS 180-4 SHA-256. A cache hit hands back a tree without ever looking at the source again, so two different
+ * sources must never look the same, and a 64 bit hash only makes that unlikely.
+ * It runs over every source we compile with a cache, so like the scanning kernels there are two versions of the part
+ * that does the work: a scalar one, and one using the SHA extensions (which most x86-64 cpus from the last few years
+ * have) that sha256_blocks() picks if it can.
+ */
+
+using Sha256Digest = std::array<uint8_t, 32>;
+
+inline constexpr uint32_t sha256_round_constants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+// Both versions take the state a, b, ..., h and run count 64 byte blocks through it
+
+inline uint32_t sha256_rotr(uint32_t x, int n) {
+    return (x >> n) | (x << (32 - n));
+}
+
+inline void scalar_sha256_blocks(uint32_t state[8], const uint8_t* p, size_t count) {
+    for (; count > 0; count--, p += 64) {
+        uint32_t w[64];
+        for (int i = 0; i < 16; i++) {
+            w[i] = uint32_t(p[i * 4]) << 24 | uint32_t(p[i * 4 + 1]) << 16 | uint32_t(p[i * 4 + 2]) << 8 | p[i * 4 + 3];
+        }
+        for (int i = 16; i < 64; i++) {
+            uint32_t s0 = sha256_rotr(w[i - 15], 7) ^ sha256_rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = sha256_rotr(w[i - 2], 17) ^ sha256_rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int i = 0; i < 64; i++) {
+            uint32_t t1 = h + (sha256_rotr(e, 6) ^ sha256_rotr(e, 11) ^ sha256_rotr(e, 25)) + ((e & f) ^ (~e & g))
+                + sha256_round_constants[i] + w[i];
+            uint32_t t2 = (sha256_rotr(a, 2) ^ sha256_rotr(a, 13) ^ sha256_rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+    }
+}
+
+#ifdef HYDRO_SHA_X86
+
+// Compiled for the SHA extensions no matter what flags the rest of the program uses, so it must only ever be called if
+// the cpu says it has them. The instructions want the state as ABEF and CDGH halves instead of in order, and each
+// sha256rnds2 does two rounds, so every 4 rounds are two of those with the message words shuffled down in between.
+// The message schedule gets worked out 4 words at a time as we go, w holds the last 16 words
+__attribute__((target("sha,sse4.1"))) inline void shani_sha256_blocks(uint32_t state[8], const uint8_t* p, size_t count) {
+    const __m128i byte_swap = _mm_set_epi64x(0x0c0d0e0f08090a0bull, 0x0405060700010203ull);
+    __m128i dcba = _mm_loadu_si128((const __m128i*) &state[0]);
+    __m128i hgfe = _mm_loadu_si128((const __m128i*) &state[4]);
+    __m128i cdab = _mm_shuffle_epi32(dcba, 0xB1);
+    __m128i efgh = _mm_shuffle_epi32(hgfe, 0x1B);
+    __m128i abef = _mm_alignr_epi8(cdab, efgh, 8);
+    __m128i cdgh = _mm_blend_epi16(efgh, cdab, 0xF0);
+
+    for (; count > 0; count--, p += 64) {
+        __m128i abef_before = abef;
+        __m128i cdgh_before = cdgh;
+        __m128i w[4];
+#pragma GCC unroll 16
+        for (int group = 0; group < 16; group++) {
+            if (group < 4) {
+                w[group] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (p + group * 16)), byte_swap);
+            }
+            __m128i words = _mm_add_epi32(w[group % 4], _mm_loadu_si128((const __m128i*) &sha256_round_constants[group * 4]));
+            cdgh = _mm_sha256rnds2_epu32(cdgh, abef, words);
+            // The 4 words after the ones we just used need the 3 groups before them
+            if (group >= 3 && group < 15) {
+                __m128i& next = w[(group + 1) % 4];
+                next = _mm_add_epi32(next, _mm_alignr_epi8(w[group % 4], w[(group + 3) % 4], 4));
+                next = _mm_sha256msg2_epu32(next, w[group % 4]);
+            }
+            abef = _mm_sha256rnds2_epu32(abef, cdgh, _mm_shuffle_epi32(words, 0x0E));
+            if (group >= 1 && group < 13) {
+                w[(group + 3) % 4] = _mm_sha256msg1_epu32(w[(group + 3) % 4], w[group % 4]);
+            }
+        }
+        abef = _mm_add_epi32(abef, abef_before);
+        cdgh = _mm_add_epi32(cdgh, cdgh_before);
+    }
+
+    __m128i feba = _mm_shuffle_epi32(abef, 0x1B);
+    __m128i dchg = _mm_shuffle_epi32(cdgh, 0xB1);
+    _mm_storeu_si128((__m128i*) &state[0], _mm_blend_epi16(feba, dchg, 0xF0));
+    _mm_storeu_si128((__m128i*) &state[4], _mm_alignr_epi8(dchg, feba, 8));
+}
+
+#endif
+
+using Sha256Blocks = void (*)(uint32_t state[8], const uint8_t* p, size_t count);
+
+inline Sha256Blocks pick_sha256_blocks() {
+#ifdef HYDRO_SHA_X86
+    if (__builtin_cpu_supports("sha") && __builtin_cpu_supports("sse4.1")) {
+        return shani_sha256_blocks;
+    }
+#endif
+    return scalar_sha256_blocks;
+}
+
+inline Sha256Blocks sha256_blocks() {
+    static const Sha256Blocks blocks = pick_sha256_blocks();
+    return blocks;
+}
+
+inline Sha256Digest sha256(std::string_view data) {
+    uint32_t state[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    const auto* p = reinterpret_cast<const uint8_t*>(data.data());
+    size_t whole = data.size() / 64;
+    sha256_blocks()(state, p, whole);
+
+    // What's left, then a 1 bit, zeroes, and the length in bits, which takes one or two more blocks
+    uint8_t tail[128] = {};
+    size_t left = data.size() % 64;
+    if (left > 0) {
+        memcpy(tail, p + whole * 64, left);
+    }
+    tail[left] = 0x80;
+    size_t tail_size = left < 56 ? 64 : 128;
+    uint64_t bits = uint64_t(data.size()) * 8;
+    for (int i = 0; i < 8; i++) {
+        tail[tail_size - 1 - i] = uint8_t(bits >> (i * 8));
+    }
+    sha256_blocks()(state, tail, tail_size / 64);
+
+    Sha256Digest digest;
+    for (int i = 0; i < 8; i++) {
+        digest[i * 4] = uint8_t(state[i] >> 24);
+        digest[i * 4 + 1] = uint8_t(state[i] >> 16);
+        digest[i * 4 + 2] = uint8_t(state[i] >> 8);
+        digest[i * 4 + 3] = uint8_t(state[i]);
+    }
+    return digest;
+}
@@ -0,0 +1,140 @@
+// File for loading the source code we are compiling into memory, and finding our way around it
+
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "scan.hpp"
+
+/*
+ * Regular files get mapped straight into our address space, so the tokenizer reads the page cache directly
+ * instead of going through fstream -> stringstream -> string, which copied every byte at least twice.
+ * Pipes and stdin ("-") can't be mapped, so for those we fall back to reading everything into a string.
+ * Either way the tokenizer only ever sees a string_view, and this object has to outlive it.
+ */
+class SourceFile {
+public:
+    inline explicit SourceFile(const std::string& path)
+    {
+        if (path == "-") {
+            read_all(STDIN_FILENO, "stdin");
+            return;
+        }
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            std::cerr << "Could not open file: " << path << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        struct stat st {};
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 && map(fd, st.st_size)) {
+            close(fd);
+            return;
+        }
+        // Not a regular file (or mmap said no), so just read it
+        read_all(fd, path);
+        close(fd);
+    }
+
+    inline ~SourceFile()
+    {
+        if (m_mapping != nullptr) {
+            munmap(m_mapping, m_size);
+        }
+    }
+
+    // We hand out views into this memory, so copying it around would be a bug
+    SourceFile(const SourceFile&) = delete;
+    SourceFile& operator=(const SourceFile&) = delete;
+
+    inline std::string_view view() const {
+        if (m_mapping != nullptr) {
+            return {static_cast<const char*>(m_mapping), m_size};
+        }
+        return m_buffer;
+    }
+
+private:
+    inline bool map(int fd, size_t size) {
+        int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+        // Fault in every page up front, we are about to read all of them anyway
+        flags |= MAP_POPULATE;
+#endif
+        void* mapping = mmap(nullptr, size, PROT_READ, flags, fd, 0);
+        if (mapping == MAP_FAILED) {
+            return false;
+        }
+        // Tokenizer goes front to back, so let the kernel read ahead aggressively
+        madvise(mapping, size, MADV_SEQUENTIAL);
+        m_mapping = mapping;
+        m_size = size;
+        return true;
+    }
+
+    // Everything up to end of file. A read that fails (a directory, a pipe that broke) is an error, not the end, or we
+    // would go on to compile whatever part of the program we got
+    inline void read_all(int fd, const std::string& path) {
+        char chunk[64 * 1024];
+        while (true) {
+            ssize_t n = read(fd, chunk, sizeof(chunk));
+            if (n > 0) {
+                m_buffer.append(chunk, n);
+            } else if (n == 0) {
+                break;
+            } else if (errno != EINTR) {
+                std::cerr << "Could not read file: " << path << ": " << strerror(errno) << std::endl;
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+
+    void* m_mapping = nullptr;
+    size_t m_size = 0;
+    // Only used by the fallback read path
+    std::string m_buffer;
+};
+
+// Both start at 1, column counts bytes
+struct SourceLocation {
+    size_t line;
+    size_t column;
+};
+
+/*
+ * Maps an offset in the source to a line and column. Nothing on the hot path tracks lines anymore, tokens only
+ * remember their offset, so we only build one of these when we actually need to print an error.
+ * Building it is one pass with the newline kernel recording where every '\n' is, then each lookup is a binary search.
+ */
+class LineIndex {
+public:
+    inline explicit LineIndex(std::string_view src)
+    {
+        const ScanKernels& scan = scan_kernels();
+        const char* end = src.data() + src.size();
+        for (const char* p = scan.find_line_end(src.data(), end); p < end; p = scan.find_line_end(p + 1, end)) {
+            m_newlines.push_back(p - src.data());
+        }
+    }
+
+    inline SourceLocation locate(size_t offset) const {
+        // Every newline before offset is a line we are past
+        size_t line = std::lower_bound(m_newlines.begin(), m_newlines.end(), offset) - m_newlines.begin();
+        size_t line_start = line == 0 ? 0 : m_newlines[line - 1] + 1;
+        return {line + 1, offset - line_start + 1};
+    }
+
+private:
+    std::vector<size_t> m_newlines;
+};
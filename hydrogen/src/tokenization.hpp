@@ -3,11 +3,26 @@
 
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cassert>
+#include <cstring>
+#include <cstdint>
+#include <optional>
 #include <string>
+#include <string_view>
 #include <vector>
 
+#include "error.hpp"
+#include "interner.hpp"
+#include "parallel.hpp"
+#include "scan.hpp"
+#include "source.hpp"
 
-enum class TokenType{
+
+// One byte each, so the token store below can pack them tightly
+enum class TokenType : uint8_t {
     exit,
     int_lit,
     semi,
@@ -27,12 +42,12 @@ enum class TokenType{
     else_,
     float_lit,
     decimal,
-
-
+    // Never in the source, this is what the parser sees once it runs out of tokens
+    eof,
 };
 
 // 2 functions in one, return precedence level of operator, and tell if token is bin operator
-std::optional<int> bin_prec(TokenType type) {
+inline std::optional<int> bin_prec(TokenType type) {
     switch (type) {
         case TokenType::plus:
             return 0;
@@ -47,162 +62,445 @@ std::optional<int> bin_prec(TokenType type) {
     }
 }
 
+/*
+ * Keyword lookup. Every alphabetic run used to get string compared against every keyword in turn, now we hash
+ * it into a small table and do a single integer compare against whatever keyword lives in that slot.
+ * To add a keyword, add it to keywords[] below, the compiler finds a hash seed with no collisions for us
+ * (and refuses to build if it cant), so lookups stay constant time no matter how many keywords we have.
+ */
+struct Keyword {
+    std::string_view text;
+    TokenType type;
+};
+
+inline constexpr Keyword keywords[] = {
+    {"exit", TokenType::exit},
+    {"let", TokenType::let},
+    {"if", TokenType::if_},
+    {"elif", TokenType::elif},
+    {"else", TokenType::else_},
+};
+
+// Longest keyword we can pack into a uint64_t, anything longer than this can't be a keyword
+inline constexpr size_t max_keyword_len = 8;
+
+// Pack up to 8 chars into an integer so checking a candidate against a keyword is one compare
+constexpr uint64_t pack_word(std::string_view word) {
+    uint64_t packed = 0;
+    for (size_t i = 0; i < word.size(); i++) {
+        packed |= uint64_t(uint8_t(word[i])) << (8 * i);
+    }
+    return packed;
+}
+
+// Power of 2 so the slot is just the top bits of the hash
+inline constexpr uint32_t keyword_table_bits = 5;
+
+// Hash on length, first two chars and last char, multiplied by a seed we pick at compile time
+constexpr uint32_t keyword_slot(std::string_view word, uint32_t seed) {
+    uint32_t key = uint32_t(uint8_t(word[0]))
+                 | uint32_t(uint8_t(word[1])) << 8
+                 | uint32_t(uint8_t(word[word.size() - 1])) << 16
+                 | uint32_t(word.size()) << 24;
+    return (key * seed) >> (32 - keyword_table_bits);
+}
+
+constexpr bool keyword_seed_works(uint32_t seed) {
+    bool used[1 << keyword_table_bits] {};
+    for (const Keyword& keyword : keywords) {
+        uint32_t slot = keyword_slot(keyword.text, seed);
+        if (used[slot]) {
+            return false;
+        }
+        used[slot] = true;
+    }
+    return true;
+}
+
+// Walk odd seeds until every keyword lands in its own slot, 0 means we never found one
+constexpr uint32_t find_keyword_seed() {
+    for (uint32_t seed = 0x9E3779B1; seed < 0x9E3779B1 + 2 * 4096; seed += 2) {
+        if (keyword_seed_works(seed)) {
+            return seed;
+        }
+    }
+    return 0;
+}
+
+inline constexpr uint32_t keyword_seed = find_keyword_seed();
+static_assert(keyword_seed != 0, "No perfect hash for the keyword set, bump keyword_table_bits");
+
+struct KeywordSlot {
+    uint64_t word = 0;
+    // 0 means nothing lives in this slot
+    size_t len = 0;
+    TokenType type = TokenType::ident;
+};
+
+constexpr std::array<KeywordSlot, 1 << keyword_table_bits> build_keyword_table() {
+    std::array<KeywordSlot, 1 << keyword_table_bits> table {};
+    for (const Keyword& keyword : keywords) {
+        KeywordSlot& slot = table[keyword_slot(keyword.text, keyword_seed)];
+        slot.word = pack_word(keyword.text);
+        slot.len = keyword.text.size();
+        slot.type = keyword.type;
+    }
+    return table;
+}
+
+inline constexpr std::array<KeywordSlot, 1 << keyword_table_bits> keyword_table = build_keyword_table();
+
+constexpr bool keywords_fit() {
+    for (const Keyword& keyword : keywords) {
+        if (keyword.text.size() < 2 || keyword.text.size() > max_keyword_len) {
+            return false;
+        }
+    }
+    return true;
+}
+static_assert(keywords_fit(), "Keywords have to be between 2 and 8 chars long");
+
+// Returns the keyword's token type if word is a keyword, nothing if it is just an identifier
+inline std::optional<TokenType> keyword_type(std::string_view word) {
+    if (word.size() < 2 || word.size() > max_keyword_len) {
+        return {};
+    }
+    const KeywordSlot& slot = keyword_table[keyword_slot(word, keyword_seed)];
+    if (slot.len == word.size() && slot.word == pack_word(word)) {
+        return slot.type;
+    }
+    return {};
+}
+
 // Struct to define a token
 struct Token {
     TokenType type;
-    // These two variables are for better error checking features
-    int line;
-    // optional<> is a wrapper (like smart pointer) that represents a val that may or may not be there
-    // this allows us to handle absence of values in a more safe way rather than using sentinels or nulls
-    std::optional<std::string> value {};
+    // Where the token starts in the source. This is also how error messages find the line and column, see LineIndex
+    uint32_t offset = 0;
+    // For identifiers, the id the interner gave this name
+    SymbolId symbol = 0;
+    // Literals get parsed once, right here in the tokenizer. int_lit holds the value, float_lit holds the bits of the
+    // (single precision) float since that is what the generator puts in an xmm register
+    uint64_t literal = 0;
 };
 
+// Most tokens the parser can look ahead at once, power of 2 so wrapping around a ring buffer is a mask
+inline constexpr size_t token_lookahead = 8;
+
+/*
+ * Compact storage for a whole list of tokens, as a structure of arrays instead of a vector<Token>.
+ * Each token is a 1 byte kind, a 32 bit offset into the source and a 32 bit payload, so 9 bytes instead of ~48.
+ * The payload is the SymbolId for identifiers (their text lives in the interner) and an index into m_literals for
+ * literals, punctuation doesn't need one. Kinds get their own array so the parser deciding what to do next only reads those,
+ * 64 to a cache line. Once finish() is called the kinds array ends in token_lookahead eof tokens, so the parser can
+ * look ahead without ever checking if it went off the end.
+ */
+class TokenStore {
+    public:
+        // src is what the offsets point into, needs to outlive the store
+        inline explicit TokenStore(std::string_view src)
+            : m_src(src)
+        {}
+
+        inline void push(const Token& token) {
+            uint32_t payload = 0;
+            if (token.type == TokenType::ident) {
+                payload = token.symbol;
+            } else if (token.type == TokenType::int_lit || token.type == TokenType::float_lit) {
+                payload = m_literals.size();
+                m_literals.push_back(token.literal);
+            }
+            m_kinds.push_back(token.type);
+            m_offsets.push_back(token.offset);
+            m_payloads.push_back(payload);
+        }
+
+        // Pad the kinds with eof, once every token is in. Nothing gets pushed or appended after this
+        inline void finish() {
+            m_kinds.insert(m_kinds.end(), token_lookahead, TokenType::eof);
+        }
+
+        inline size_t size() const {
+            return m_offsets.size();
+        }
+
+        // Once finished, fine to ask for up to token_lookahead past the end, those are all eof
+        inline TokenType kind(size_t index) const {
+            return m_kinds[index];
+        }
+
+        // Build the full token back up
+        inline Token get(size_t index) const {
+            Token token {.type = m_kinds[index], .offset = m_offsets[index]};
+            if (token.type == TokenType::ident) {
+                token.symbol = m_payloads[index];
+            } else if (token.type == TokenType::int_lit || token.type == TokenType::float_lit) {
+                token.literal = m_literals[m_payloads[index]];
+            }
+            return token;
+        }
+
+        // What the offsets point into
+        inline std::string_view source() const {
+            return m_src;
+        }
+
+        // Tack another store for the same source on the end, mapping its identifiers through symbols
+        inline void append(const TokenStore& other, const std::vector<SymbolId>& symbols) {
+            uint32_t literal_base = m_literals.size();
+            m_literals.insert(m_literals.end(), other.m_literals.begin(), other.m_literals.end());
+            m_kinds.insert(m_kinds.end(), other.m_kinds.begin(), other.m_kinds.begin() + other.size());
+            for (size_t i = 0; i < other.size(); i++) {
+                uint32_t payload = other.m_payloads[i];
+                if (other.m_kinds[i] == TokenType::ident) {
+                    payload = symbols[payload];
+                } else if (other.m_kinds[i] == TokenType::int_lit || other.m_kinds[i] == TokenType::float_lit) {
+                    payload += literal_base;
+                }
+                m_offsets.push_back(other.m_offsets[i]);
+                m_payloads.push_back(payload);
+            }
+        }
+
+    private:
+        std::string_view m_src;
+        std::vector<TokenType> m_kinds;
+        std::vector<uint32_t> m_offsets;
+        std::vector<uint32_t> m_payloads;
+        // Values of the literals, in the order they show up
+        std::vector<uint64_t> m_literals;
+};
+
+/*
+ * The tokenizer is a table driven DFA. Every byte gets looked up in char_classes to get its CharClass, and
+ * lex_transitions[state][class] says where to go next. That replaces the old if/else ladder which called the
+ * locale dependent std::isalpha/isdigit/isspace on every byte and did up to ~20 compares to find punctuation.
+ */
+enum class CharClass : uint8_t {
+    invalid,
+    space,
+    alpha,
+    digit,
+    dot,
+    slash,
+    star,
+    open_paran,
+    close_paran,
+    semi,
+    equals,
+    plus,
+    sub,
+    open_curly,
+    close_curly,
+    // Not a real byte, what we see once we run off the end of the source
+    eof,
+    count,
+};
+
+constexpr std::array<CharClass, 256> build_char_classes() {
+    std::array<CharClass, 256> classes {};
+    for (int c = 0; c < 256; c++) {
+        classes[c] = CharClass::invalid;
+    }
+    for (int c = 'a'; c <= 'z'; c++) {
+        classes[c] = CharClass::alpha;
+    }
+    for (int c = 'A'; c <= 'Z'; c++) {
+        classes[c] = CharClass::alpha;
+    }
+    for (int c = '0'; c <= '9'; c++) {
+        classes[c] = CharClass::digit;
+    }
+    for (char c : {' ', '\t', '\n', '\v', '\f', '\r'}) {
+        classes[uint8_t(c)] = CharClass::space;
+    }
+    classes['.'] = CharClass::dot;
+    classes['/'] = CharClass::slash;
+    classes['*'] = CharClass::star;
+    classes['('] = CharClass::open_paran;
+    classes[')'] = CharClass::close_paran;
+    classes[';'] = CharClass::semi;
+    classes['='] = CharClass::equals;
+    classes['+'] = CharClass::plus;
+    classes['-'] = CharClass::sub;
+    classes['{'] = CharClass::open_curly;
+    classes['}'] = CharClass::close_curly;
+    return classes;
+}
+
+inline constexpr std::array<CharClass, 256> char_classes = build_char_classes();
+
+enum class LexState : uint8_t {
+    start,
+    ident,
+    // Digits, turns into float_lit as soon as we see a '.'
+    int_lit,
+    // Started with digits and has had a '.', so more digits and dots are fine, i.e 6.69
+    float_lit,
+    // Started with a '.', so only digits from here on, i.e .69
+    dot_float_lit,
+    // Seen a '/', could still be a comment
+    slash,
+    // Single char tokens like ( or ;
+    punct,
+    // Everything below here stops the DFA. done means the char we are looking at belongs to the next token
+    done,
+    space,
+    line_comment,
+    block_comment,
+    invalid,
+    count,
+};
+
+constexpr std::array<std::array<LexState, size_t(CharClass::count)>, size_t(LexState::count)> build_lex_transitions() {
+    std::array<std::array<LexState, size_t(CharClass::count)>, size_t(LexState::count)> table {};
+    // Anything we don't say otherwise about ends the current token
+    for (auto& row : table) {
+        for (LexState& next : row) {
+            next = LexState::done;
+        }
+    }
+
+    auto& start = table[size_t(LexState::start)];
+    for (LexState& next : start) {
+        next = LexState::punct;
+    }
+    start[size_t(CharClass::invalid)] = LexState::invalid;
+    start[size_t(CharClass::space)] = LexState::space;
+    start[size_t(CharClass::alpha)] = LexState::ident;
+    start[size_t(CharClass::digit)] = LexState::int_lit;
+    start[size_t(CharClass::dot)] = LexState::dot_float_lit;
+    start[size_t(CharClass::slash)] = LexState::slash;
+    start[size_t(CharClass::eof)] = LexState::done;
+
+    table[size_t(LexState::ident)][size_t(CharClass::alpha)] = LexState::ident;
+    table[size_t(LexState::ident)][size_t(CharClass::digit)] = LexState::ident;
+
+    table[size_t(LexState::int_lit)][size_t(CharClass::digit)] = LexState::int_lit;
+    table[size_t(LexState::int_lit)][size_t(CharClass::dot)] = LexState::float_lit;
+    table[size_t(LexState::float_lit)][size_t(CharClass::digit)] = LexState::float_lit;
+    table[size_t(LexState::float_lit)][size_t(CharClass::dot)] = LexState::float_lit;
+    table[size_t(LexState::dot_float_lit)][size_t(CharClass::digit)] = LexState::dot_float_lit;
+
+    table[size_t(LexState::slash)][size_t(CharClass::slash)] = LexState::line_comment;
+    table[size_t(LexState::slash)][size_t(CharClass::star)] = LexState::block_comment;
+    return table;
+}
+
+inline constexpr std::array<std::array<LexState, size_t(CharClass::count)>, size_t(LexState::count)> lex_transitions = build_lex_transitions();
+
+// Token type for the single char tokens, indexed by CharClass
+constexpr std::array<TokenType, size_t(CharClass::count)> build_punct_tokens() {
+    std::array<TokenType, size_t(CharClass::count)> tokens {};
+    tokens[size_t(CharClass::star)] = TokenType::star;
+    tokens[size_t(CharClass::open_paran)] = TokenType::open_paran;
+    tokens[size_t(CharClass::close_paran)] = TokenType::close_paran;
+    tokens[size_t(CharClass::semi)] = TokenType::semi;
+    tokens[size_t(CharClass::equals)] = TokenType::equals;
+    tokens[size_t(CharClass::plus)] = TokenType::plus;
+    tokens[size_t(CharClass::sub)] = TokenType::sub;
+    tokens[size_t(CharClass::open_curly)] = TokenType::open_curly;
+    tokens[size_t(CharClass::close_curly)] = TokenType::close_curly;
+    return tokens;
+}
+
+inline constexpr std::array<TokenType, size_t(CharClass::count)> punct_tokens = build_punct_tokens();
+
 class Tokenizer {
     public:
-        inline explicit Tokenizer(std::string src)
-            : m_src(std::move(src))
+        // src is a view of the source buffer, which needs to outlive the tokenizer
+        // Identifiers get interned into interner as we go
+        // begin/end let us tokenize just a piece of src, offsets in the tokens still count from the start of src
+        inline explicit Tokenizer(std::string_view src, Interner& interner, size_t begin = 0, size_t end = SIZE_MAX)
+            : m_src(src),
+              m_interner(interner),
+              m_index(begin),
+              m_end(std::min(end, src.size()))
         {
+            // Token offsets are 32 bits
+            if (src.size() > UINT32_MAX) {
+                throw CompileError("Source file too big, max is 4GB");
+            }
         }
 
-        // Turn the m_src string into a list of tokens.
-        inline std::vector<Token> tokenize() {
-            int line_count = 1;
-            std::string buf;
-            std::vector<Token> tokens;
-            while (peek().has_value()) {
-                // Case for keywords
-                if (std::isalpha(peek().value())) {
-                    buf.push_back(consume());
-                    while (peek().has_value() && std::isalnum(peek().value())) {
-                        buf.push_back(consume());
-                    }
-                    if (buf == "exit") {
-                        tokens.push_back({.type = TokenType::exit, line_count});
-                        buf.clear();
-                        continue;
-                    } else if (buf == "let") {
-                        tokens.push_back({.type = TokenType::let, line_count});
-                        buf.clear();
-                        continue;
-                    } else if (buf == "if") {
-                        tokens.push_back({.type = TokenType::if_, line_count});
-                        buf.clear();
-                        continue;
-                    } else if (buf == "elif") {
-                        tokens.push_back({.type = TokenType::elif, line_count});
-                        buf.clear();
-                    } else if (buf == "else") {
-                        tokens.push_back({.type = TokenType::else_, line_count});
-                        buf.clear();
-                    } else {
-                        tokens.push_back({.type = TokenType::ident, line_count, .value = buf});
-                        buf.clear();
-                        continue;
-                    }
-                } else if (peek().value() == '\n') {
-                    consume();
-                    line_count++;
-                } else if (peek().value() == '.') {
-                    // Case for a decimal that starts with '.' i.e .69
-                    buf.push_back(consume());
-                    while(peek().has_value() && std::isdigit(peek().value())) {
-                        buf.push_back(consume());
-                    }
-                    tokens.push_back({TokenType::float_lit, line_count, .value = buf});
-                    buf.clear();
-                } else if (std::isdigit(peek().value())) {
-                    // Includes case for int lit and float that starts with another number, i.e 6.69
-                    buf.push_back(consume());
-                    bool has_decimal = 0;
-                    while (peek().has_value() && (std::isdigit(peek().value()) || peek().value() == '.')) {
-                        if (peek().value() == '.') {
-                            has_decimal = 1;
-                        }
-                        buf.push_back(consume());
-                    }
-
-                    if (has_decimal) {
-                        tokens.push_back({TokenType::float_lit, line_count, .value = buf});
-                        buf.clear();
-                    } else {
-                        tokens.push_back({.type = TokenType::int_lit , line_count, .value = buf});
-                        buf.clear();
-                    }
-                } else if (std::isspace(peek().value())) {
-                    consume();
-                } else if (peek().value() == '/' && peek(1).has_value() && peek(1).value() == '/') {
-                    consume();
+        // Lex just the next token out of m_src, nothing once we hit the end. This is what lets the parser pull
+        // tokens as it needs them instead of us making the whole list up front
+        inline std::optional<Token> next() {
+            while (m_index < m_end) {
+                size_t start = m_index;
+                CharClass first = char_class();
+                LexState state = lex_transitions[size_t(LexState::start)][size_t(first)];
+
+                if (state == LexState::space) {
+                    // Skip the whole run of whitespace at once
+                    m_index = m_scan.skip_whitespace(m_src.data() + m_index, src_end()) - m_src.data();
+                    continue;
+                } else if (state == LexState::invalid) {
+                    error("Invalid Token!", m_index);
+                }
+                consume();
+
+                // Run the DFA until the next char can't be part of this token
+                LexState next;
+                while ((next = lex_transitions[size_t(state)][size_t(char_class())]) < LexState::done) {
+                    state = next;
                     consume();
+                }
 
-                    // Keep going until we encounter a new line, but dont need to consume newline bc isspace does that
-                    while (peek().has_value() && peek().value() != '\n') {
-                        consume();
-                    }
-                } else if (peek().value() == '/' && peek(1).has_value() && peek(1).value() == '*') {
+                if (next == LexState::line_comment) {
                     consume();
+                    // Jump to the next new line, but dont need to consume newline bc the whitespace case does that
+                    m_index = m_scan.find_line_end(m_src.data() + m_index, src_end()) - m_src.data();
+                    continue;
+                } else if (next == LexState::block_comment) {
                     consume();
+                    // Jump to the closing */ (or the end of the file if there isnt one), block comments can span lines
+                    const char* stop = m_scan.find_block_end(m_src.data() + m_index, src_end());
+                    m_index = std::min<size_t>(stop - m_src.data() + 2, m_end);
+                    continue;
+                }
 
-                    while (peek().has_value()) {
-                        if (peek().value() == '*' && peek(1).has_value() && peek(1).value() == '/') {
-                            break;
+                switch (state) {
+                    case LexState::ident:
+                        if (auto keyword = keyword_type(lexeme(start))) {
+                            return Token{.type = keyword.value(), .offset = uint32_t(start)};
                         }
-                        consume();
-                    }
-                    if (peek().has_value()) {
-                        consume();
-                    }
-                    if (peek().has_value()) {
-                        consume();
-                    }
-                } else if (peek().value() == '(') {
-                    consume();
-                    tokens.push_back({.type = TokenType::open_paran, line_count});
-                } else if (peek().value() == ')') {
-                    consume();
-                    tokens.push_back({.type = TokenType::close_paran, line_count});
-                } else if (peek().value() == ';') {
-                    consume();
-                    tokens.push_back({.type = TokenType::semi, line_count});
-                } else if (peek().value() == '=') {
-                    consume();
-                    tokens.push_back({.type = TokenType::equals, line_count});
-                } else if (peek().value() == '+') {
-                    consume();
-                    tokens.push_back({.type = TokenType::plus, line_count});
-                } else if (peek().value() == '*') {
-                    consume();
-                    tokens.push_back({.type = TokenType::star, line_count});
-                }  else if (peek().value() == '-') {
-                    consume();
-                    tokens.push_back({.type = TokenType::sub, line_count});
-                } else if (peek().value() == '/') {
-                    consume();
-                    tokens.push_back({.type = TokenType::div, line_count});
-                } else if (peek().value() == '{') {
-                    consume();
-                    tokens.push_back({.type = TokenType::open_curly, line_count});
-                } else if (peek().value() == '}') {
-                    consume();
-                    tokens.push_back({.type = TokenType::close_curly, line_count});
-                } else {
-                    std::cerr << "Invalid Token!" << std::endl;
-                    exit(EXIT_FAILURE);
+                        return Token{.type = TokenType::ident, .offset = uint32_t(start), .symbol = m_interner.intern(lexeme(start))};
+                    case LexState::int_lit:
+                        return Token{.type = TokenType::int_lit, .offset = uint32_t(start), .literal = parse_int(start)};
+                    case LexState::float_lit:
+                    case LexState::dot_float_lit:
+                        return Token{.type = TokenType::float_lit, .offset = uint32_t(start), .literal = parse_float(start)};
+                    case LexState::slash:
+                        return Token{.type = TokenType::div, .offset = uint32_t(start)};
+                    default:
+                        return Token{.type = punct_tokens[size_t(first)], .offset = uint32_t(start)};
                 }
             }
-            m_index = 0;
+            return {};
+        }
+
+        // Turn the m_src string into a list of tokens.
+        inline TokenStore tokenize() {
+            TokenStore tokens(m_src);
+            while (auto token = next()) {
+                tokens.push(token.value());
+            }
+            tokens.finish();
             return tokens;
         }
 
+        inline std::string_view source() const {
+            return m_src;
+        }
+
     private:
-        // Const values need to be used o/w compiler throws error because if we cant modify it, we are using its return value somewhere, o/w function doesnt do anything
-        // This function peeks ahead a certain number of characters in a string to see if it exists and what it is.
-        inline std::optional<char> peek(int offset = 0) const {
-            if (m_index + offset >= m_src.length()) {
-                // OOB, return {}, which returns default instance of that variable, in this case empty string. If func was returning ptr, it would return nullptr
-                return {};
-            } else {
-                return m_src[m_index + offset];
+        // Class of the char we are looking at, or eof once we have run out of source
+        inline CharClass char_class() const {
+            if (m_index >= m_end) {
+                return CharClass::eof;
             }
+            return char_classes[uint8_t(m_src[m_index])];
         }
 
         // Return the current char in string, and increment counter to next char.
@@ -211,6 +509,219 @@ class Tokenizer {
             return m_src[m_index++];
         }
 
-        std::string m_src;
+        inline const char* src_end() const {
+            return m_src.data() + m_end;
+        }
+
+        // View of everything we consumed since start, points straight into the source so there is no copy
+        inline std::string_view lexeme(size_t start) const {
+            return m_src.substr(start, m_index - start);
+        }
+
+        // Integer literal we just lexed. Anything that fits in 64 bits is fine, mov rax takes all of them
+        inline uint64_t parse_int(size_t start) const {
+            std::string_view text = lexeme(start);
+            uint64_t value = 0;
+            if (std::from_chars(text.data(), text.data() + text.size(), value).ec != std::errc()) {
+                error("Integer literal too big!", start);
+            }
+            return value;
+        }
+
+        // Float literal we just lexed, as the bits of a single precision float. from_chars is correctly rounded and
+        // fast (libstdc++ uses the Eisel-Lemire algorithm), and like stof it stops at a second '.' so 1.2.3 is 1.2
+        inline uint64_t parse_float(size_t start) const {
+            std::string_view text = lexeme(start);
+            float value = 0;
+            if (std::from_chars(text.data(), text.data() + text.size(), value).ec != std::errc()) {
+                error("Invalid float literal!", start);
+            }
+            uint32_t bits;
+            memcpy(&bits, &value, sizeof(bits));
+            return bits;
+        }
+
+        [[noreturn]] inline void error(const std::string& msg, size_t offset) const {
+            SourceLocation location = LineIndex(m_src).locate(offset);
+            throw CompileError(at_location(msg, location), location);
+        }
+
+        std::string_view m_src;
+        Interner& m_interner;
         size_t m_index = 0;
-};
\ No newline at end of file
+        // One past the last char we are allowed to look at
+        size_t m_end = 0;
+        // Whitespace and comment scanners, picked once for whatever cpu we are on
+        const ScanKernels& m_scan = scan_kernels();
+};
+
+/*
+ * Tokenize a big source on several threads. We cut it into one chunk per thread, always right after a '\n' so no
+ * token gets split, and lex each chunk with its own Tokenizer. The one thing a chunk can't know on its own is whether
+ * it starts inside a block comment, so a quick pass over the source first (which only stops at '/' chars) moves any
+ * cut that lands inside a block comment to just past the end of it.
+ * Chunks also intern into their own Interner so the threads never share one, and stitching maps those ids onto
+ * interner. Doing that chunk by chunk in order hands out the same ids a single Tokenizer would have.
+ * The result is exactly what Tokenizer::tokenize() would have given us.
+ */
+inline TokenStore tokenize_parallel(std::string_view src, size_t threads, Interner& interner) {
+    // Not worth waking threads up for less than this per chunk
+    constexpr size_t min_chunk_size = 1024 * 1024;
+    const ScanKernels& scan = scan_kernels();
+    const char* begin = src.data();
+    const char* end = src.data() + src.size();
+
+    size_t chunk_count = std::max<size_t>(1, std::min(threads, src.size() / min_chunk_size));
+    std::vector<size_t> starts {0};
+    for (size_t i = 1; i < chunk_count; i++) {
+        size_t target = std::max(src.size() / chunk_count * i, starts.back());
+        const char* newline = scan.find_line_end(begin + target, end);
+        if (newline + 1 >= end) {
+            break;
+        }
+        starts.push_back(newline + 1 - begin);
+    }
+
+    // Walk the comments, and push any cut inside a block comment out to where it ends
+    size_t next_start = 1;
+    const char* p = begin;
+    while (p < end && next_start < starts.size()) {
+        p = static_cast<const char*>(memchr(p, '/', end - p));
+        if (p == nullptr || p + 1 >= end) {
+            break;
+        }
+        if (p[1] == '/') {
+            // Line comments stop at a newline, so they can't have a cut inside them
+            p = scan.find_line_end(p + 2, end);
+        } else if (p[1] == '*') {
+            size_t open = p - begin;
+            p = std::min(scan.find_block_end(p + 2, end) + 2, end);
+            size_t close = p - begin;
+            while (next_start < starts.size() && starts[next_start] <= open) {
+                next_start++;
+            }
+            while (next_start < starts.size() && starts[next_start] < close) {
+                starts[next_start++] = close;
+            }
+        } else {
+            p++;
+        }
+    }
+    starts.push_back(src.size());
+
+    size_t chunks = starts.size() - 1;
+    std::vector<std::optional<TokenStore>> chunk_tokens(chunks);
+    std::vector<Interner> chunk_interners(chunks);
+    parallel_for(chunks, threads, [&](size_t i) {
+        chunk_tokens[i] = Tokenizer(src, chunk_interners[i], starts[i], starts[i + 1]).tokenize();
+    });
+
+    TokenStore tokens(src);
+    std::vector<SymbolId> symbols;
+    for (size_t i = 0; i < chunks; i++) {
+        symbols.resize(chunk_interners[i].size());
+        for (SymbolId id = 0; id < symbols.size(); id++) {
+            symbols[id] = interner.intern(chunk_interners[i].name(id));
+        }
+        tokens.append(chunk_tokens[i].value(), symbols);
+        // Free each chunk as soon as it is copied so we don't hold two copies of everything
+        chunk_tokens[i].reset();
+    }
+    tokens.finish();
+    return tokens;
+}
+
+/*
+ * Pull based view of the tokenizer for the parser. Tokens get lexed only when the parser peeks or consumes them,
+ * and only the few we are looking ahead at live in a tiny ring buffer, so we never hold the whole token list in memory.
+ * It can also just walk a TokenStore somebody already made, like tokenize_parallel() above.
+ *
+ * Nothing here hands out copies or optionals. Once the tokens run out every peek is an eof token, so the parser never
+ * has to check whether there is a token before looking at it, and consume() hands back a reference.
+ */
+class TokenStream {
+    public:
+        static constexpr size_t lookahead = token_lookahead;
+
+        inline explicit TokenStream(Tokenizer& tokenizer)
+            : m_tokenizer(&tokenizer)
+        {
+        }
+
+        // tokens has to outlive the stream. Only tokens begin up to end get walked, past end looks like eof
+        inline explicit TokenStream(const TokenStore& tokens, size_t begin = 0, size_t end = SIZE_MAX)
+            : m_store(&tokens),
+              m_next(begin),
+              m_end(std::min(end, tokens.size()))
+        {
+        }
+
+        // Type of the token offset places past the next one to be consumed, eof if there isn't one
+        inline TokenType peek_type(size_t offset = 0) {
+            assert(offset < lookahead);
+            if (m_store != nullptr) {
+                return m_next + offset < m_end ? m_store->kind(m_next + offset) : TokenType::eof;
+            }
+            fill(offset + 1);
+            return m_ring[(m_head + offset) & (lookahead - 1)].type;
+        }
+
+        // The reference is good until the next consume(), which is all the parser ever needs
+        inline const Token& consume() {
+            if (m_store != nullptr) {
+                assert(m_next < m_end);
+                // Only the token we actually consume gets built back up out of the store
+                m_current = m_store->get(m_next++);
+                return m_current;
+            }
+            fill(1);
+            // Copied out, since peeking further ahead can refill the ring slot it came from
+            m_current = m_ring[m_head];
+            m_head = (m_head + 1) & (lookahead - 1);
+            m_count--;
+            return m_current;
+        }
+
+        // Last token we consumed, for error messages. Before we have consumed anything, an eof at the very start
+        inline const Token& previous() const {
+            return m_current;
+        }
+
+        // Source the tokens came from, so error messages can work out where they are
+        inline std::string_view source() const {
+            if (m_store != nullptr) {
+                return m_store->source();
+            }
+            return m_tokenizer->source();
+        }
+
+    private:
+        // Lex until we have at least count tokens buffered, once the tokenizer runs dry we pad with eof
+        inline void fill(size_t count) {
+            while (m_count < count) {
+                Token& slot = m_ring[(m_head + m_count) & (lookahead - 1)];
+                if (auto token = m_tokenizer->next()) {
+                    slot = token.value();
+                } else {
+                    slot = {.type = TokenType::eof, .offset = uint32_t(m_tokenizer->source().size())};
+                }
+                m_count++;
+            }
+        }
+
+        // Exactly one of these is set, depending on which constructor we came from
+        Tokenizer* m_tokenizer = nullptr;
+        const TokenStore* m_store = nullptr;
+
+        // Ring buffer for the tokenizer
+        std::array<Token, lookahead> m_ring {};
+        size_t m_head = 0;
+        size_t m_count = 0;
+
+        // Where we are in the store and where we stop
+        size_t m_next = 0;
+        size_t m_end = 0;
+
+        // The last token consumed, either built back up out of the store or copied out of the ring
+        Token m_current {.type = TokenType::eof};
+};
@@ -0,0 +1,477 @@
+// File for turning the generator's instructions into x86-64 machine code, and/or nasm assembly text
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "emit.hpp"
+#include "error.hpp"
+
+// Numbered the way the cpu numbers them, which is what goes in the instruction bytes
+enum class Reg : uint8_t {
+    rax,
+    rcx,
+    rdx,
+    rbx,
+    rsp,
+    rbp,
+    rsi,
+    rdi,
+};
+
+enum class Xmm : uint8_t {
+    xmm0,
+    xmm1,
+};
+
+// Scalar single precision arithmetic, the value is the last opcode byte
+enum class SseOp : uint8_t {
+    addss = 0x58,
+    mulss = 0x59,
+    subss = 0x5C,
+    divss = 0x5E,
+};
+
+// A spot in the code to jump to, written out as label0, label1, ...
+struct Label {
+    uint32_t id;
+
+    friend inline AsmBuffer& operator<<(AsmBuffer& output, Label label) {
+        return output << "label" << label.id;
+    }
+};
+
+/*
+ * The generator calls one of these per instruction, and it writes the nasm text for it (if we want text), encodes the
+ * machine code for it (if we want code), or both. Only the handful of instructions the generator uses are here, each
+ * in the exact forms it uses them, so the text comes out the same as it always has.
+ *
+ * The code is one flat .text section. Everything but jumps has a fixed size, so it goes straight into m_code. Jumps
+ * can't be encoded until we know where their labels are, and their size depends on how far they go (2 bytes for
+ * a short jump within 127 bytes, 5 or 6 for a near one), so they get left out of m_code and remembered in m_jumps.
+ * finish_code() then works out their sizes and stitches everything together (see relax_jumps).
+ */
+class Assembler {
+public:
+    // text_fd is where the text goes as we write it, see AsmBuffer
+    inline Assembler(bool text, int text_fd, bool code)
+        : m_code_enabled(code)
+    {
+        if (text) {
+            m_text.emplace(text_fd);
+        }
+    }
+
+    // Everything before the program proper: the entry point
+    inline void begin_program() {
+        if (m_text) {
+            *m_text << "global _start\n_start:\n";
+        }
+    }
+
+    // exit(0) once we fall off the end of the program. The text version has never had a newline after it
+    inline void end_program() {
+        mov(Reg::rax, 60);
+        mov(Reg::rdi, 0);
+        if (m_text) {
+            *m_text << "    syscall";
+        }
+        code({0x0F, 0x05});
+    }
+
+    // Text only, ";; " gets put in front and a newline after
+    inline void comment(std::string_view text, std::string_view more = {}) {
+        if (m_text) {
+            *m_text << "    ;; " << text << more << "\n";
+        }
+    }
+
+    inline void push(Reg reg) {
+        if (m_text) {
+            *m_text << "    push " << name(reg) << "\n";
+        }
+        code({uint8_t(0x50 + uint8_t(reg))});
+    }
+
+    inline void pop(Reg reg) {
+        if (m_text) {
+            *m_text << "    pop " << name(reg) << "\n";
+        }
+        code({uint8_t(0x58 + uint8_t(reg))});
+    }
+
+    // push QWORD [rsp + disp]
+    inline void push_slot(uint64_t disp) {
+        if (m_text) {
+            *m_text << "    push QWORD [rsp + " << disp << "]\n";
+        }
+        if (m_code_enabled) {
+            code({0xFF});
+            rsp_operand(6, disp);
+        }
+    }
+
+    inline void mov(Reg reg, uint64_t imm) {
+        if (m_text) {
+            *m_text << "    mov " << name(reg) << ", " << imm << "\n";
+        }
+        mov_code(reg, imm);
+    }
+
+    // Same thing, written in hex
+    inline void mov(Reg reg, Hex imm) {
+        if (m_text) {
+            *m_text << "    mov " << name(reg) << ", 0x" << imm << "\n";
+        }
+        mov_code(reg, imm.value);
+    }
+
+    // movq xmm, reg
+    inline void movq(Xmm xmm, Reg reg) {
+        if (m_text) {
+            *m_text << "    movq " << name(xmm) << ", " << name(reg) << "\n";
+        }
+        code({0x66, rex_w, 0x0F, 0x6E, modrm_reg(uint8_t(xmm), uint8_t(reg))});
+    }
+
+    // mov [rsp + disp], reg
+    inline void store(uint64_t disp, Reg reg) {
+        if (m_text) {
+            *m_text << "    mov [rsp + " << disp << "], " << name(reg) << "\n";
+        }
+        if (m_code_enabled) {
+            code({rex_w, 0x89});
+            rsp_operand(uint8_t(reg), disp);
+        }
+    }
+
+    // movq [rsp + disp], xmm
+    inline void store(uint64_t disp, Xmm xmm) {
+        if (m_text) {
+            *m_text << "    movq [rsp + " << disp << "], " << name(xmm) << "\n";
+        }
+        movq_store_code(disp, xmm);
+    }
+
+    // movq qword [rsp], xmm
+    inline void store_top(Xmm xmm) {
+        if (m_text) {
+            *m_text << "    movq qword [rsp], " << name(xmm) << "\n";
+        }
+        movq_store_code(0, xmm);
+    }
+
+    // movq xmm, QWORD [rsp]
+    inline void load_top(Xmm xmm) {
+        if (m_text) {
+            *m_text << "    movq " << name(xmm) << ", QWORD [rsp]\n";
+        }
+        if (m_code_enabled) {
+            code({0xF3, 0x0F, 0x7E});
+            rsp_operand(uint8_t(xmm), 0);
+        }
+    }
+
+    inline void add(Reg reg, uint64_t imm) {
+        if (m_text) {
+            *m_text << "    add " << name(reg) << ", " << imm << "\n";
+        }
+        arith_imm_code(0, reg, imm);
+    }
+
+    inline void sub(Reg reg, uint64_t imm) {
+        if (m_text) {
+            *m_text << "    sub " << name(reg) << ", " << imm << "\n";
+        }
+        arith_imm_code(5, reg, imm);
+    }
+
+    inline void add(Reg dst, Reg src) {
+        reg_reg("add", 0x01, dst, src);
+    }
+
+    inline void sub(Reg dst, Reg src) {
+        reg_reg("sub", 0x29, dst, src);
+    }
+
+    inline void test(Reg dst, Reg src) {
+        reg_reg("test", 0x85, dst, src);
+    }
+
+    // rdx:rax = rax * src
+    inline void mul(Reg src) {
+        if (m_text) {
+            *m_text << "    mul " << name(src) << "\n";
+        }
+        code({rex_w, 0xF7, modrm_reg(4, uint8_t(src))});
+    }
+
+    // rax = rdx:rax / src
+    inline void div(Reg src) {
+        if (m_text) {
+            *m_text << "    div " << name(src) << "\n";
+        }
+        code({rex_w, 0xF7, modrm_reg(6, uint8_t(src))});
+    }
+
+    inline void sse(SseOp op, Xmm dst, Xmm src) {
+        if (m_text) {
+            *m_text << "    " << name(op) << " " << name(dst) << ", " << name(src) << "\n";
+        }
+        code({0xF3, 0x0F, uint8_t(op), modrm_reg(uint8_t(dst), uint8_t(src))});
+    }
+
+    inline void syscall() {
+        if (m_text) {
+            *m_text << "    syscall\n";
+        }
+        code({0x0F, 0x05});
+    }
+
+    inline Label new_label() {
+        m_labels.push_back({.at = unbound});
+        return {uint32_t(m_labels.size() - 1)};
+    }
+
+    // The label points at whatever comes next
+    inline void bind(Label label) {
+        if (m_text) {
+            *m_text << label << ":\n";
+        }
+        m_labels[label.id] = {.at = uint32_t(m_code.size()), .jumps_before = uint32_t(m_jumps.size())};
+    }
+
+    inline void jmp(Label label) {
+        if (m_text) {
+            *m_text << "    jmp " << label << "\n";
+        }
+        jump_code(label, false);
+    }
+
+    inline void jz(Label label) {
+        if (m_text) {
+            *m_text << "    jz " << label << "\n";
+        }
+        jump_code(label, true);
+    }
+
+    // All the text, "" if there wasn't any or it all went to text_fd
+    inline std::string finish_text() {
+        return m_text ? m_text->finish() : std::string();
+    }
+
+    // The finished machine code, every jump sized and pointed at its label
+    inline std::vector<uint8_t> finish_code() {
+        // nasm used to catch these for us, a jump to a label nobody bound has nowhere to go
+        for (const Jump& jump : m_jumps) {
+            if (m_labels[jump.label].at == unbound) {
+                throw CompileError("Jump to label" + std::to_string(jump.label) + " which is never defined");
+            }
+        }
+        relax_jumps();
+        std::vector<uint8_t> out;
+        out.reserve(m_code.size() + m_jumps.size() * near_jz_size);
+        uint32_t copied = 0;
+        for (size_t i = 0; i < m_jumps.size(); i++) {
+            const Jump& jump = m_jumps[i];
+            out.insert(out.end(), m_code.begin() + copied, m_code.begin() + jump.at);
+            copied = jump.at;
+            int64_t disp = label_address(jump.label) - int64_t(out.size() + jump.size);
+            if (jump.size == short_jump_size) {
+                out.push_back(jump.conditional ? 0x74 : 0xEB);
+                out.push_back(uint8_t(int8_t(disp)));
+            } else {
+                if (jump.conditional) {
+                    out.push_back(0x0F);
+                    out.push_back(0x84);
+                } else {
+                    out.push_back(0xE9);
+                }
+                append_le(out, uint32_t(int32_t(disp)), 4);
+            }
+        }
+        out.insert(out.end(), m_code.begin() + copied, m_code.end());
+        return out;
+    }
+
+private:
+    static constexpr uint8_t rex_w = 0x48;
+    static constexpr uint32_t unbound = UINT32_MAX;
+    static constexpr uint8_t short_jump_size = 2;
+    static constexpr uint8_t near_jmp_size = 5;
+    static constexpr uint8_t near_jz_size = 6;
+
+    // A jump that goes at offset at in m_code, once it knows how big it is
+    struct Jump {
+        uint32_t at;
+        uint32_t label;
+        bool conditional;
+        uint8_t size = short_jump_size;
+    };
+
+    // Where a label went in m_code, and how many jumps (which aren't in m_code) came before it
+    struct LabelSpot {
+        uint32_t at;
+        uint32_t jumps_before = 0;
+    };
+
+    static inline std::string_view name(Reg reg) {
+        static constexpr std::string_view names[] = {"rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi"};
+        return names[size_t(reg)];
+    }
+
+    static inline std::string_view name(Xmm xmm) {
+        return xmm == Xmm::xmm0 ? "xmm0" : "xmm1";
+    }
+
+    static inline std::string_view name(SseOp op) {
+        switch (op) {
+            case SseOp::addss:
+                return "addss";
+            case SseOp::mulss:
+                return "mulss";
+            case SseOp::subss:
+                return "subss";
+            case SseOp::divss:
+                return "divss";
+        }
+        return "";
+    }
+
+    // ModRM byte for two registers, reg is the field that names a register or an opcode extension
+    static inline uint8_t modrm_reg(uint8_t reg, uint8_t rm) {
+        return 0xC0 | (reg << 3) | rm;
+    }
+
+    inline void code(std::initializer_list<uint8_t> bytes) {
+        if (m_code_enabled) {
+            m_code.insert(m_code.end(), bytes);
+        }
+    }
+
+    static inline void append_le(std::vector<uint8_t>& out, uint64_t value, int bytes) {
+        for (int i = 0; i < bytes; i++) {
+            out.push_back(uint8_t(value >> (8 * i)));
+        }
+    }
+
+    // Displacements and immediates in these instructions are signed 32 bits at most
+    static inline uint32_t check_imm32(uint64_t value) {
+        if (value > INT32_MAX) {
+            throw CompileError("Stack offset too big for x86-64: " + std::to_string(value));
+        }
+        return uint32_t(value);
+    }
+
+    // ModRM + SIB (+ displacement) for [rsp + disp]. rsp as a base always needs the SIB byte, and the displacement
+    // takes 0, 1 or 4 bytes depending on how big it is
+    inline void rsp_operand(uint8_t reg, uint64_t disp) {
+        uint32_t disp32 = check_imm32(disp);
+        uint8_t rsp = uint8_t(Reg::rsp);
+        if (disp32 == 0) {
+            code({uint8_t((reg << 3) | rsp), 0x24});
+        } else if (disp32 <= INT8_MAX) {
+            code({uint8_t(0x40 | (reg << 3) | rsp), 0x24, uint8_t(disp32)});
+        } else {
+            code({uint8_t(0x80 | (reg << 3) | rsp), 0x24});
+            append_le(m_code, disp32, 4);
+        }
+    }
+
+    // Anything that fits in 32 bits can use the short form, writing the low half zeroes the high half
+    inline void mov_code(Reg reg, uint64_t imm) {
+        if (!m_code_enabled) {
+            return;
+        }
+        if (imm <= UINT32_MAX) {
+            code({uint8_t(0xB8 + uint8_t(reg))});
+            append_le(m_code, imm, 4);
+        } else {
+            code({rex_w, uint8_t(0xB8 + uint8_t(reg))});
+            append_le(m_code, imm, 8);
+        }
+    }
+
+    inline void movq_store_code(uint64_t disp, Xmm xmm) {
+        if (m_code_enabled) {
+            code({0x66, 0x0F, 0xD6});
+            rsp_operand(uint8_t(xmm), disp);
+        }
+    }
+
+    // add/sub reg, imm. ext is the opcode extension that picks which one
+    inline void arith_imm_code(uint8_t ext, Reg reg, uint64_t imm) {
+        if (!m_code_enabled) {
+            return;
+        }
+        uint32_t imm32 = check_imm32(imm);
+        if (imm32 <= INT8_MAX) {
+            code({rex_w, 0x83, modrm_reg(ext, uint8_t(reg)), uint8_t(imm32)});
+        } else {
+            code({rex_w, 0x81, modrm_reg(ext, uint8_t(reg))});
+            append_le(m_code, imm32, 4);
+        }
+    }
+
+    // op dst, src, for the ones that are opcode r/m64, r64
+    inline void reg_reg(std::string_view mnemonic, uint8_t opcode, Reg dst, Reg src) {
+        if (m_text) {
+            *m_text << "    " << mnemonic << " " << name(dst) << ", " << name(src) << "\n";
+        }
+        code({rex_w, opcode, modrm_reg(uint8_t(src), uint8_t(dst))});
+    }
+
+    inline void jump_code(Label label, bool conditional) {
+        if (m_code_enabled) {
+            m_jumps.push_back({.at = uint32_t(m_code.size()), .label = label.id, .conditional = conditional});
+        }
+    }
+
+    // Where a label ends up once every jump before it has its size, m_jump_shift has to be up to date
+    inline int64_t label_address(uint32_t label) const {
+        const LabelSpot& spot = m_labels[label];
+        return int64_t(spot.at) + m_jump_shift[spot.jumps_before];
+    }
+
+    /*
+     * Every jump starts out short, and any that can't reach its label that way grows to near. Growing one moves
+     * everything after it, which can push other jumps out of reach, so we go around again until nothing grows.
+     * Jumps only ever grow, so this always stops, and in practice it takes a pass or two.
+     */
+    inline void relax_jumps() {
+        m_jump_shift.assign(m_jumps.size() + 1, 0);
+        bool grew = true;
+        while (grew) {
+            grew = false;
+            // How far everything after the first i jumps gets pushed by them
+            for (size_t i = 0; i < m_jumps.size(); i++) {
+                m_jump_shift[i + 1] = m_jump_shift[i] + m_jumps[i].size;
+            }
+            for (size_t i = 0; i < m_jumps.size(); i++) {
+                Jump& jump = m_jumps[i];
+                if (jump.size != short_jump_size) {
+                    continue;
+                }
+                int64_t end = int64_t(jump.at) + m_jump_shift[i] + short_jump_size;
+                int64_t disp = label_address(jump.label) - end;
+                if (disp < INT8_MIN || disp > INT8_MAX) {
+                    jump.size = jump.conditional ? near_jz_size : near_jmp_size;
+                    grew = true;
+                }
+            }
+        }
+    }
+
+    std::optional<AsmBuffer> m_text;
+    bool m_code_enabled;
+    // The code, minus the jumps
+    std::vector<uint8_t> m_code;
+    std::vector<Jump> m_jumps;
+    std::vector<LabelSpot> m_labels;
+    std::vector<int64_t> m_jump_shift;
+};
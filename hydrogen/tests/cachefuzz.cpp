@@ -0,0 +1,337 @@
+// Round trip and fuzz test for the AST cache in src/cache.hpp. Every source gets parsed, stored and loaded back, and
+// what comes back has to match what was parsed, pool for pool and name for name, and generate the same assembly.
+// Then the saved tree gets broken over and over, both as nodes (ids pointing anywhere, kinds we don't have, ...) and
+// as bytes in the file, and every broken file has to either be turned down or load as a tree that generates without
+// crashing. Build with -fsanitize=address to also catch one that generates by reading past the end of a pool.
+//
+// ./hydro_cachefuzz                    100 random programs
+// ./hydro_cachefuzz -n 50 a.hy b.hy    50 random programs, plus a.hy and b.hy
+//
+// Random programs and the breakage come from a fixed seed, so a failure reproduces. The first one gets printed along
+// with the source, and we exit 1.
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "../src/cache.hpp"
+#include "../src/generation.hpp"
+#include "random.hpp"
+
+// Where things sit in the Header at the start of a cache file
+constexpr size_t format_offset = 8;
+constexpr size_t body_size_offset = 8 * 2 + 32;
+constexpr size_t checksum_offset = body_size_offset + 8;
+constexpr size_t header_size = checksum_offset + 8 * 2;
+
+// Assembly for prog, or the error generating it ran into
+std::string generate(const NodeProg& prog, const Interner& interner) {
+    Assembler assembler(true, -1, true);
+    try {
+        Generator(&prog, interner, assembler).gen_prog();
+    } catch (const CompileError& error) {
+        return std::string("error: ") + error.what();
+    }
+    std::string text = assembler.finish_text();
+    assembler.finish_code();
+    return text;
+}
+
+// Every field of every node of every pool, so two trees can be compared without looking at padding
+std::vector<uint64_t> fields(const NodeProg& prog) {
+    std::vector<uint64_t> out;
+    visit_pools(prog, [&](const auto& pool, const auto&...) {
+        out.push_back(pool.size());
+        for (size_t i = 0; i < pool.size(); i++) {
+            visit_fields(pool[i], [&](const auto& value) {
+                out.push_back(uint64_t(value));
+            });
+        }
+    });
+    return out;
+}
+
+std::string read_file(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    std::ostringstream contents;
+    contents << in.rdbuf();
+    return contents.str();
+}
+
+// The one file in dir, which is where AstCache put the one tree we stored there
+std::string only_file(const std::string& dir) {
+    return std::filesystem::directory_iterator(dir)->path();
+}
+
+// Write file back out with its header saying it's all there and the checksum matching, so load gets past both
+void write_fixed(const std::string& path, std::string file) {
+    uint64_t format;
+    memcpy(&format, file.data() + format_offset, 8);
+    uint64_t body_size = file.size() - header_size;
+    uint64_t checksum = hash_bytes(file.data() + header_size, body_size, format);
+    memcpy(file.data() + body_size_offset, &body_size, 8);
+    memcpy(file.data() + checksum_offset, &checksum, 8);
+    std::ofstream(path, std::ios::binary) << file;
+}
+
+// Set one field of one node somewhere in prog to something it probably shouldn't be
+void break_node(NodeProg& prog, Random& rng) {
+    size_t pools = 0;
+    visit_pools(prog, [&](auto&, const auto&...) { pools++; });
+    size_t target = rng.below(pools);
+    visit_pools(prog, [&](auto& pool, const auto&...) {
+        if (target-- != 0 || pool.size() == 0) {
+            return;
+        }
+        auto& node = pool[rng.below(pool.size())];
+        size_t count = 0;
+        visit_fields(node, [&](auto&) { count++; });
+        size_t field = rng.below(count);
+        visit_fields(node, [&](auto& value) {
+            if (field-- != 0) {
+                return;
+            }
+            using Field = std::decay_t<decltype(value)>;
+            uint64_t old = uint64_t(value);
+            switch (rng.below(4)) {
+                case 0:
+                    value = Field(old + 1 + rng.below(3));
+                    break;
+                case 1:
+                    value = Field(old - 1 - rng.below(3));
+                    break;
+                case 2:
+                    value = Field(rng.below(pool.size() + 2));
+                    break;
+                default:
+                    value = Field(rng.next());
+            }
+        });
+    });
+}
+
+// Flip bits in, overwrite, or cut short the body of file
+void break_bytes(std::string& file, Random& rng) {
+    size_t body = file.size() - header_size;
+    switch (rng.below(3)) {
+        case 0:
+            for (size_t n = 1 + rng.below(4); n > 0; n--) {
+                file[header_size + rng.below(body)] ^= char(1 << rng.below(8));
+            }
+            break;
+        case 1:
+            file[header_size + rng.below(body)] = char(rng.next());
+            break;
+        default:
+            file.resize(header_size + rng.below(body));
+    }
+}
+
+// Copy the first name over a later one that's just as long, false if there isn't one. The names come first in the
+// body, as a length each and then the names themselves
+bool duplicate_name(std::string& file, const Interner& interner) {
+    size_t at = header_size + interner.size();
+    for (SymbolId id = 0; id < interner.size(); id++) {
+        if (interner.name(id).size() >= 0x80) {
+            return false;
+        }
+    }
+    for (SymbolId id = 0; id < interner.size(); id++) {
+        if (id > 0 && interner.name(id).size() == interner.name(0).size() && interner.name(id) != interner.name(0)) {
+            file.replace(at, interner.name(0).size(), interner.name(0));
+            return true;
+        }
+        at += interner.name(id).size();
+    }
+    return false;
+}
+
+std::string random_expr(Random& rng, const std::vector<std::string>& vars, int depth) {
+    std::string out;
+    switch (rng.below(depth > 0 ? 5 : 3)) {
+        case 0:
+            out = std::to_string(rng.below(1000));
+            break;
+        case 1:
+            out = std::to_string(rng.below(100)) + "." + std::to_string(rng.below(100));
+            break;
+        case 2:
+            out = vars.empty() ? "7" : vars[rng.below(vars.size())];
+            break;
+        default:
+            out = "(" + random_expr(rng, vars, depth - 1) + ")";
+    }
+    if (depth > 0 && rng.below(2) == 0) {
+        static constexpr const char* ops[] = {" + ", " - ", " * ", " / "};
+        out += ops[rng.below(std::size(ops))] + random_expr(rng, vars, depth - 1);
+    }
+    return out;
+}
+
+// Statements that use only variables that are live, and declare only ones that aren't, so they generate. Names never
+// get reused (next counts up), which is all that takes
+std::string random_stmts(Random& rng, std::vector<std::string> vars, size_t& next, int depth) {
+    std::string out;
+    for (size_t n = rng.below(8); n > 0; n--) {
+        switch (rng.below(depth > 0 ? 7 : 4)) {
+            case 0:
+            case 1:
+                out += "let v" + std::to_string(next) + " = " + random_expr(rng, vars, 3) + ";\n";
+                vars.push_back("v" + std::to_string(next++));
+                break;
+            case 2:
+                if (!vars.empty()) {
+                    out += vars[rng.below(vars.size())] + " = " + random_expr(rng, vars, 3) + ";\n";
+                }
+                break;
+            case 3:
+                out += "exit(" + random_expr(rng, vars, 2) + ");\n";
+                break;
+            case 4:
+                out += "{\n" + random_stmts(rng, vars, next, depth - 1) + "}\n";
+                break;
+            default:
+                out += "if (" + random_expr(rng, vars, 2) + ") {\n" + random_stmts(rng, vars, next, depth - 1) + "}";
+                for (size_t elifs = rng.below(3); elifs > 0; elifs--) {
+                    out += " elif (" + random_expr(rng, vars, 2) + ") {\n" + random_stmts(rng, vars, next, depth - 1) + "}";
+                }
+                if (rng.below(2) == 0) {
+                    out += " else {\n" + random_stmts(rng, vars, next, depth - 1) + "}";
+                }
+                out += "\n";
+        }
+    }
+    return out;
+}
+
+std::string random_program(Random& rng) {
+    size_t next = 0;
+    return random_stmts(rng, {}, next, 3);
+}
+
+int main(int argc, char** argv) {
+    size_t random_programs = 100;
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; i++) {
+        if (std::string_view(argv[i]) == "-n" && i + 1 < argc) {
+            random_programs = std::strtoul(argv[++i], nullptr, 10);
+        } else {
+            files.push_back(argv[i]);
+        }
+    }
+
+    std::vector<std::pair<std::string, std::string>> sources;
+    for (const std::string& file : files) {
+        std::ifstream in(file, std::ios::binary);
+        if (!in) {
+            std::cerr << "Could not open file: " << file << std::endl;
+            return EXIT_FAILURE;
+        }
+        std::ostringstream contents;
+        contents << in.rdbuf();
+        sources.emplace_back(file, contents.str());
+    }
+    Random rng(0x9E3779B97F4A7C15ull);
+    for (size_t i = 0; i < random_programs; i++) {
+        sources.emplace_back("random program " + std::to_string(i), random_program(rng));
+    }
+
+    char dir_template[] = "/tmp/hydro_cachefuzz.XXXXXX";
+    if (mkdtemp(dir_template) == nullptr) {
+        std::cerr << "Could not make a directory to cache in" << std::endl;
+        return EXIT_FAILURE;
+    }
+    const std::string dir = dir_template;
+    auto fail = [&](const std::string& name, const std::string& src, const std::string& what) {
+        std::cerr << name << ": " << what << "\n--- source ---\n" << src << "\n--- end ---" << std::endl;
+        std::filesystem::remove_all(dir);
+        return EXIT_FAILURE;
+    };
+
+    Parser parser;
+    size_t loaded = 0;
+    size_t turned_down = 0;
+    for (const auto& [name, src] : sources) {
+        std::filesystem::remove_all(dir);
+        std::filesystem::create_directory(dir);
+        Interner interner;
+        Tokenizer tokenizer(src, interner);
+        const NodeProg* parsed;
+        try {
+            parsed = &parser.parse_prog(tokenizer);
+        } catch (const CompileError& error) {
+            return fail(name, src, std::string("doesn't parse: ") + error.what());
+        }
+        const Sha256Digest key = sha256(src);
+        AstCache cache;
+        cache.store(dir, key, *parsed, interner);
+        const std::string good = read_file(only_file(dir));
+
+        NodeProg prog;
+        Interner names;
+        if (!cache.load(dir, key, prog, names)) {
+            return fail(name, src, "what we stored didn't load");
+        }
+        bool same_names = names.size() == interner.size();
+        for (SymbolId id = 0; same_names && id < names.size(); id++) {
+            same_names = names.name(id) == interner.name(id);
+        }
+        if (!same_names || fields(prog) != fields(*parsed)) {
+            return fail(name, src, "what we loaded isn't what we stored");
+        }
+        if (generate(prog, names) != generate(*parsed, interner)) {
+            return fail(name, src, "what we loaded generates different assembly");
+        }
+
+        std::string duplicated = good;
+        if (duplicate_name(duplicated, interner)) {
+            write_fixed(only_file(dir), duplicated);
+            NodeProg broken;
+            Interner broken_names;
+            if (cache.load(dir, key, broken, broken_names)) {
+                return fail(name, src, "a file with the same name in it twice loaded");
+            }
+        }
+
+        // Everything stored from here on is broken, but goes in the same file. prog keeps pointing into the mapping
+        // of the good one, so that's loaded by a cache of its own
+        AstCache fuzz_cache;
+        for (size_t round = 0; round < 50; round++) {
+            if (round % 2 == 0) {
+                NodeProg broken;
+                Interner broken_names;
+                AstCache original;
+                std::ofstream(only_file(dir), std::ios::binary) << good;
+                original.load(dir, key, broken, broken_names);
+                break_node(broken, rng);
+                fuzz_cache.store(dir, key, broken, broken_names);
+            } else {
+                std::string file = good;
+                break_bytes(file, rng);
+                write_fixed(only_file(dir), file);
+            }
+            NodeProg broken;
+            Interner broken_names;
+            if (fuzz_cache.load(dir, key, broken, broken_names)) {
+                generate(broken, broken_names);
+                loaded++;
+            } else {
+                turned_down++;
+            }
+        }
+    }
+    std::filesystem::remove_all(dir);
+    std::cout << "cachefuzz: " << sources.size() << " programs round trip, of the broken files " << loaded
+              << " loaded and " << turned_down << " were turned down" << std::endl;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,369 @@
+// Differential test for the tokenizer: runs the table driven Tokenizer and the if/else ladder it replaced over the
+// same sources and checks they agree on every token's type, offset and payload, and on where (if anywhere) lexing
+// fails. The ladder is kept here as the reference, written the plain way with no scan kernels, keyword hash or
+// from_chars, so it shares no code with the tokenizer it is checking.
+//
+// ./hydro_lexdiff                    10000 random sources
+// ./hydro_lexdiff -n 500 a.hy b.hy   500 random sources, plus a.hy and b.hy
+//
+// Random sources come from a fixed seed, so a failure reproduces. The first mismatch gets printed along with the
+// source, and we exit 1.
+
+#include <cctype>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "../src/tokenization.hpp"
+#include "random.hpp"
+
+// What both tokenizers get boiled down to. text is the identifier's name, literal the int value or float bits
+struct LexedToken {
+    TokenType type;
+    size_t offset;
+    std::string text;
+    uint64_t literal = 0;
+
+    bool operator==(const LexedToken& other) const {
+        return type == other.type && offset == other.offset && text == other.text && literal == other.literal;
+    }
+};
+
+struct Lexed {
+    std::vector<LexedToken> tokens;
+    // Where lexing stopped with an error, and the tokens before it are all we got
+    bool failed = false;
+    SourceLocation error {0, 0};
+};
+
+/*
+ * The tokenizer as it was before the DFA: an if/else ladder over std::isalpha/isdigit/isspace, with keywords found by
+ * comparing strings. Literals get parsed with strtoull and strtof, which (like from_chars) round correctly.
+ */
+class LadderTokenizer {
+public:
+    explicit LadderTokenizer(std::string_view src)
+        : m_src(src)
+    {}
+
+    Lexed tokenize() {
+        Lexed lexed;
+        while (m_index < m_src.size()) {
+            size_t start = m_index;
+            unsigned char c = m_src[m_index];
+            if (std::isalpha(c)) {
+                m_index++;
+                while (m_index < m_src.size() && std::isalnum((unsigned char) m_src[m_index])) {
+                    m_index++;
+                }
+                std::string buf(lexeme(start));
+                if (buf == "exit") {
+                    lexed.tokens.push_back({TokenType::exit, start, ""});
+                } else if (buf == "let") {
+                    lexed.tokens.push_back({TokenType::let, start, ""});
+                } else if (buf == "if") {
+                    lexed.tokens.push_back({TokenType::if_, start, ""});
+                } else if (buf == "elif") {
+                    lexed.tokens.push_back({TokenType::elif, start, ""});
+                } else if (buf == "else") {
+                    lexed.tokens.push_back({TokenType::else_, start, ""});
+                } else {
+                    lexed.tokens.push_back({TokenType::ident, start, buf});
+                }
+            } else if (std::isspace(c)) {
+                m_index++;
+            } else if (c == '.') {
+                m_index++;
+                while (m_index < m_src.size() && std::isdigit((unsigned char) m_src[m_index])) {
+                    m_index++;
+                }
+                if (!push_float(lexed, start)) {
+                    return lexed;
+                }
+            } else if (std::isdigit(c)) {
+                m_index++;
+                bool has_decimal = false;
+                while (m_index < m_src.size() && (std::isdigit((unsigned char) m_src[m_index]) || m_src[m_index] == '.')) {
+                    has_decimal |= m_src[m_index] == '.';
+                    m_index++;
+                }
+                bool pushed = has_decimal ? push_float(lexed, start) : push_int(lexed, start);
+                if (!pushed) {
+                    return lexed;
+                }
+            } else if (c == '/' && m_index + 1 < m_src.size() && m_src[m_index + 1] == '/') {
+                m_index += 2;
+                while (m_index < m_src.size() && m_src[m_index] != '\n') {
+                    m_index++;
+                }
+            } else if (c == '/' && m_index + 1 < m_src.size() && m_src[m_index + 1] == '*') {
+                size_t close = m_src.find("*/", m_index + 2);
+                m_index = close == std::string_view::npos ? m_src.size() : close + 2;
+            } else if (auto type = punct(c)) {
+                m_index++;
+                lexed.tokens.push_back({type.value(), start, ""});
+            } else {
+                fail(lexed, start);
+                return lexed;
+            }
+        }
+        return lexed;
+    }
+
+private:
+    static std::optional<TokenType> punct(char c) {
+        switch (c) {
+            case '(': return TokenType::open_paran;
+            case ')': return TokenType::close_paran;
+            case ';': return TokenType::semi;
+            case '=': return TokenType::equals;
+            case '+': return TokenType::plus;
+            case '*': return TokenType::star;
+            case '-': return TokenType::sub;
+            case '/': return TokenType::div;
+            case '{': return TokenType::open_curly;
+            case '}': return TokenType::close_curly;
+            default: return {};
+        }
+    }
+
+    std::string_view lexeme(size_t start) const {
+        return m_src.substr(start, m_index - start);
+    }
+
+    void fail(Lexed& lexed, size_t offset) const {
+        lexed.failed = true;
+        lexed.error = LineIndex(m_src).locate(offset);
+    }
+
+    bool push_int(Lexed& lexed, size_t start) {
+        std::string text(lexeme(start));
+        errno = 0;
+        unsigned long long value = strtoull(text.c_str(), nullptr, 10);
+        if (errno == ERANGE) {
+            fail(lexed, start);
+            return false;
+        }
+        lexed.tokens.push_back({TokenType::int_lit, start, "", value});
+        return true;
+    }
+
+    // Stops at a second '.', so 1.2.3 is 1.2. A lone '.' is no number at all, and one too big for a float or so
+    // small it rounds away to nothing is an error
+    bool push_float(Lexed& lexed, size_t start) {
+        std::string text(lexeme(start));
+        char* end = nullptr;
+        errno = 0;
+        float value = strtof(text.c_str(), &end);
+        if (end == text.c_str() || (errno == ERANGE && (value == 0 || std::isinf(value)))) {
+            fail(lexed, start);
+            return false;
+        }
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        lexed.tokens.push_back({TokenType::float_lit, start, "", bits});
+        return true;
+    }
+
+    std::string_view m_src;
+    size_t m_index = 0;
+};
+
+Lexed lex_with_dfa(std::string_view src) {
+    Lexed lexed;
+    Interner interner;
+    Tokenizer tokenizer(src, interner);
+    try {
+        while (auto token = tokenizer.next()) {
+            LexedToken lexed_token {token->type, token->offset, ""};
+            if (token->type == TokenType::ident) {
+                lexed_token.text = interner.name(token->symbol);
+            } else if (token->type == TokenType::int_lit || token->type == TokenType::float_lit) {
+                lexed_token.literal = token->literal;
+            }
+            lexed.tokens.push_back(lexed_token);
+        }
+    } catch (const CompileError& error) {
+        lexed.failed = true;
+        lexed.error = error.location;
+    }
+    return lexed;
+}
+
+std::string digits(Random& rng, size_t max) {
+    std::string out;
+    for (size_t n = 1 + rng.below(max); n > 0; n--) {
+        out += char('0' + rng.below(10));
+    }
+    return out;
+}
+
+// One piece of a source. Pieces get glued together with or without whitespace, so tokens also end up right next to
+// each other (let1, 1.2.3., a//b, ...) which is where the two tokenizers are most likely to disagree
+std::string piece(Random& rng) {
+    static constexpr const char* words[] = {"exit", "let", "if", "elif", "else", "exi", "lets", "iff", "el", "e", "l"};
+    static constexpr char letters[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
+    static constexpr char punct[] = "();=+*-/{}";
+    static constexpr char spaces[] = " \t\n\r\v\f";
+    // No '.', a comment that ends early would leave one behind, and a lone '.' is an error that cuts the source short.
+    // '\n' goes last so line comments can leave it out
+    static constexpr char comment_chars[] = "ab */\t1;(\n";
+    std::string out;
+    switch (rng.below(12)) {
+        case 0:
+            return words[rng.below(std::size(words))];
+        case 1:
+            out = letters[rng.below(52)];
+            for (size_t n = rng.below(6); n > 0; n--) {
+                out += rng.below(3) == 0 ? char('0' + rng.below(10)) : letters[rng.below(52)];
+            }
+            return out;
+        case 2:
+            // Anything past 20 digits is too big for 64 bits
+            return digits(rng, rng.below(200) == 0 ? 24 : 8);
+        case 3:
+            out = digits(rng, 6) + "." + digits(rng, 6);
+            // 1.2.3 and 1.2. are floats too
+            while (rng.below(6) == 0) {
+                out += "." + (rng.below(2) == 0 ? digits(rng, 3) : "");
+            }
+            return out;
+        case 4:
+            // .69, and now and then a lone '.'
+            return rng.below(300) == 0 ? "." : "." + digits(rng, 6);
+        case 5:
+        case 6:
+        case 7:
+            return std::string(1, punct[rng.below(std::size(punct) - 1)]);
+        case 8:
+            for (size_t n = 1 + rng.below(3); n > 0; n--) {
+                out += spaces[rng.below(std::size(spaces) - 1)];
+            }
+            return out;
+        case 9:
+            out = "//";
+            // Everything but the '\n', which would end it
+            for (size_t n = rng.below(10); n > 0; n--) {
+                out += comment_chars[rng.below(std::size(comment_chars) - 2)];
+            }
+            return out;
+        case 10:
+            out = "/*";
+            for (size_t n = rng.below(12); n > 0; n--) {
+                out += comment_chars[rng.below(std::size(comment_chars) - 1)];
+            }
+            // Most get closed, the rest run to the end of the source (or the next */ somebody else wrote)
+            if (rng.below(8) != 0) {
+                out += "*/";
+            }
+            return out;
+        default:
+            // Bytes the language doesn't have, including NUL and ones that are negative as a char
+            if (rng.below(400) == 0) {
+                static constexpr char invalid[] = {'#', '@', '"', '\0', char(0x80), char(0xE9), char(0xFF)};
+                return std::string(1, invalid[rng.below(std::size(invalid))]);
+            }
+            return " ";
+    }
+}
+
+std::string random_source(Random& rng) {
+    std::string src;
+    for (size_t n = rng.below(200); n > 0; n--) {
+        src += piece(rng);
+        if (rng.below(3) != 0) {
+            src += ' ';
+        }
+    }
+    return src;
+}
+
+std::string describe(const LexedToken& token) {
+    std::ostringstream out;
+    out << "type " << int(token.type) << " at " << token.offset;
+    if (!token.text.empty()) {
+        out << " '" << token.text << "'";
+    }
+    if (token.type == TokenType::int_lit || token.type == TokenType::float_lit) {
+        out << " literal " << token.literal;
+    }
+    return out.str();
+}
+
+// Empty if they agree, otherwise what the first difference is
+std::string compare(const Lexed& ladder, const Lexed& dfa) {
+    size_t common = std::min(ladder.tokens.size(), dfa.tokens.size());
+    for (size_t i = 0; i < common; i++) {
+        if (!(ladder.tokens[i] == dfa.tokens[i])) {
+            return "token " + std::to_string(i) + ": ladder has " + describe(ladder.tokens[i]) + ", dfa has "
+                + describe(dfa.tokens[i]);
+        }
+    }
+    if (ladder.tokens.size() != dfa.tokens.size()) {
+        return "ladder made " + std::to_string(ladder.tokens.size()) + " tokens, dfa made " + std::to_string(dfa.tokens.size());
+    }
+    if (ladder.failed != dfa.failed) {
+        return ladder.failed ? "only the ladder failed" : "only the dfa failed";
+    }
+    if (ladder.failed && (ladder.error.line != dfa.error.line || ladder.error.column != dfa.error.column)) {
+        return "ladder failed at " + std::to_string(ladder.error.line) + ":" + std::to_string(ladder.error.column)
+            + ", dfa at " + std::to_string(dfa.error.line) + ":" + std::to_string(dfa.error.column);
+    }
+    return {};
+}
+
+int main(int argc, char** argv) {
+    size_t random_sources = 10000;
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; i++) {
+        if (std::string_view(argv[i]) == "-n" && i + 1 < argc) {
+            random_sources = std::strtoul(argv[++i], nullptr, 10);
+        } else {
+            files.push_back(argv[i]);
+        }
+    }
+
+    std::vector<std::pair<std::string, std::string>> sources;
+    for (const std::string& file : files) {
+        std::ifstream in(file, std::ios::binary);
+        if (!in) {
+            std::cerr << "Could not open file: " << file << std::endl;
+            return EXIT_FAILURE;
+        }
+        std::ostringstream contents;
+        contents << in.rdbuf();
+        sources.emplace_back(file, contents.str());
+    }
+    Random rng(0x2545F4914F6CDD1Dull);
+    for (size_t i = 0; i < random_sources; i++) {
+        sources.emplace_back("random source " + std::to_string(i), random_source(rng));
+    }
+
+    size_t tokens = 0;
+    size_t failures = 0;
+    for (const auto& [name, src] : sources) {
+        Lexed ladder = LadderTokenizer(src).tokenize();
+        Lexed dfa = lex_with_dfa(src);
+        std::string difference = compare(ladder, dfa);
+        if (!difference.empty()) {
+            std::cerr << name << ": " << difference << "\n--- source ---\n" << src << "\n--- end ---" << std::endl;
+            return EXIT_FAILURE;
+        }
+        tokens += dfa.tokens.size();
+        failures += dfa.failed;
+    }
+    std::cout << "lexdiff: " << sources.size() << " sources, " << tokens << " tokens, " << failures
+              << " lex errors, no differences" << std::endl;
+    return EXIT_SUCCESS;
+}
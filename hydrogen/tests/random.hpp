@@ -0,0 +1,28 @@
+// File for the random numbers lexdiff, lexbench and cachefuzz make their sources from
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Small xorshift so the sources come out the same on every machine and standard library
+class Random {
+public:
+    explicit Random(uint64_t seed)
+        : m_state(seed)
+    {}
+
+    uint64_t next() {
+        m_state ^= m_state << 13;
+        m_state ^= m_state >> 7;
+        m_state ^= m_state << 17;
+        return m_state;
+    }
+
+    size_t below(size_t n) {
+        return next() % n;
+    }
+
+private:
+    uint64_t m_state;
+};